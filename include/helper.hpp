@@ -1,6 +1,7 @@
 #ifndef mmbwmon_helper_hpp
 #define mmbwmon_helper_hpp
 
+#include <fstream>
 #include <string>
 
 #include <cassert>
@@ -9,6 +10,8 @@
 /*** config vars **/
 extern std::string server;
 extern size_t port;
+// path of the Unix domain socket used instead of MQTT, empty for MQTT
+extern std::string local_socket;
 
 inline std::string get_hostname() {
 	char hostname[255];
@@ -17,6 +20,14 @@ inline std::string get_hostname() {
 	return std::string(hostname);
 }
 
+// resident set size of this process in bytes, 0 if unknown
+inline size_t resident_bytes() {
+	std::ifstream statm("/proc/self/statm");
+	size_t size = 0, resident = 0;
+	if (!(statm >> size >> resident)) return 0;
+	return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
 /*** MQTT constants ***/
 const std::string baseTopic = "fast/agent/" + get_hostname() + "/mmbwmon";
 
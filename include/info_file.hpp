@@ -0,0 +1,23 @@
+#ifndef mmbwmon_info_file_hpp
+#define mmbwmon_info_file_hpp
+
+#include <distgen/distgen.h>
+
+#include <fast-lib/message/agent/mmbwmon/system_info.hpp>
+
+/**
+ * Whether the calibration results in @p info were measured with the SMT
+ * factor, buffer size and placement in use. Info files of older versions do
+ * not contain the buffer size and placement (0), these are accepted.
+ */
+bool info_matches(const fast::msg::agent::mmbwmon::system_info &info, const distgend_initT &init, size_t buffer_size,
+				  const distgend_placementT &placement);
+
+/**
+ * Restores the bandwidth of the compact cores from @p info if it was written
+ * by an older version without curves on the same topology. Returns false if
+ * not. distgend_init_uncalibrated() must have been called with @p init.
+ */
+bool restore_legacy_info(fast::msg::agent::mmbwmon::system_info info, const distgend_initT &init);
+
+#endif /* end of include guard: mmbwmon_info_file_hpp */
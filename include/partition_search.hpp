@@ -0,0 +1,80 @@
+#ifndef mmbwmon_partition_search_hpp
+#define mmbwmon_partition_search_hpp
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <vector>
+
+/**
+ * Splits the ways of a cache between applications so that their weighted
+ * throughput is maximal. Every application gets a contiguous block of at least
+ * min_ways ways, the blocks do not overlap.
+ *
+ * All applications run concurrently, so every measurement of an allocation
+ * yields a point of the throughput over ways curve of every application. The
+ * curves are refined by bisection only where neighbouring points differ by more
+ * than tolerance of the application's best throughput and interpolated
+ * elsewhere. Allocations where an application gets more ways without gaining
+ * more than tolerance are dominated and skipped, the best of the others is
+ * found by dynamic programming over the curves.
+ */
+class partition_search {
+public:
+	using ways_t = std::vector<size_t>;
+
+	// applies the allocation and returns the throughput (e.g. instructions/s) of every application
+	using measure_fn = std::function<std::vector<double>(const ways_t &ways)>;
+
+	partition_search(measure_fn measure, std::vector<double> weights, size_t total_ways, size_t min_ways,
+					 double tolerance);
+
+	/**
+	 * Whether @p apps applications can get at least @p min_ways of @p total_ways
+	 * each, and a class of service (CLOSID) of the @p closids besides the one
+	 * of the default group.
+	 */
+	static bool can_partition(size_t apps, size_t total_ways, size_t min_ways, size_t closids);
+
+	// measures until the curves are known well enough and returns the best allocation,
+	// ways not needed by any application are left unallocated
+	ways_t run();
+
+	// the allocation giving every application the same number of ways
+	ways_t equal_split() const;
+
+	// the throughput of app with ways, interpolated between the measured points
+	double predicted(size_t app, size_t ways) const;
+
+	// sum of weight * throughput relative to the application's throughput with the most ways
+	double weighted_throughput(const std::vector<double> &throughput) const;
+	double predicted_weighted_throughput(const ways_t &ways) const;
+
+	size_t measurements() const { return count; }
+
+private:
+	struct point {
+		double sum;
+		size_t count;
+	};
+
+	size_t max_ways() const { return total_ways - (weights.size() - 1) * min_ways; }
+	void measure_allocation(const ways_t &ways);
+	// app gets ways, the others split the rest evenly
+	ways_t allocation_for(size_t app, size_t ways) const;
+	// true if a point between two measured points of app was measured
+	bool refine(size_t app);
+	ways_t best() const;
+
+	const measure_fn measure;
+	const std::vector<double> weights;
+	const size_t total_ways;
+	const size_t min_ways;
+	const double tolerance;
+
+	// measured throughput of every application by ways
+	std::vector<std::map<size_t, point>> curves;
+	size_t count = 0;
+};
+
+#endif /* end of include guard: mmbwmon_partition_search_hpp */
@@ -0,0 +1,87 @@
+#ifndef mmbwmon_passive_hpp
+#define mmbwmon_passive_hpp
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * A source of memory traffic counters. read_bytes() returns the bytes
+ * transferred by the memory controllers of every NUMA node since an arbitrary
+ * but fixed point in time.
+ */
+class bandwidth_source {
+public:
+	virtual ~bandwidth_source() = default;
+
+	virtual std::map<size_t, std::uint64_t> read_bytes() = 0;
+	virtual std::string name() const = 0;
+};
+
+/**
+ * Creates a bandwidth source from @p spec:
+ * - "imc":        perf uncore IMC events (cas_count_read/cas_count_write)
+ * - "mbm":        resctrl mon_data/ * /mbm_total_bytes
+ * - "file:<dir>": one file node<N> per NUMA node in <dir>, containing the bytes
+ *                 transferred so far. Meant for testing.
+ * - "auto":       imc if available, mbm otherwise
+ * @p cpu_to_node maps OS CPU ids to NUMA nodes.
+ * Throws std::runtime_error if the source is not available.
+ */
+std::unique_ptr<bandwidth_source> make_bandwidth_source(const std::string &spec,
+														const std::map<size_t, size_t> &cpu_to_node);
+
+// the GByte/s of @p bytes in @p seconds, a GByte being 1024^3 bytes as in distgen
+inline double gbyte_per_s(double bytes, double seconds) { return bytes / 1024.0 / 1024.0 / 1024.0 / seconds; }
+
+/**
+ * Samples a bandwidth source in a background thread and keeps the last samples
+ * (GByte/s per NUMA node).
+ */
+class passive_monitor {
+public:
+	passive_monitor(std::unique_ptr<bandwidth_source> source, std::chrono::milliseconds interval, size_t history);
+	~passive_monitor();
+
+	passive_monitor(const passive_monitor &) = delete;
+	passive_monitor &operator=(const passive_monitor &) = delete;
+
+	/**
+	 * Returns the GByte/s used on every NUMA node averaged over the stored
+	 * samples. Empty if no sample has been taken yet.
+	 */
+	std::map<size_t, double> bandwidth() const;
+
+	/**
+	 * Blocks until at least one sample is available. Throws std::runtime_error
+	 * with the last error of the source if there is none after @p timeout.
+	 */
+	void wait_for_sample(std::chrono::milliseconds timeout) const;
+
+	std::string source_name() const { return source->name(); }
+
+private:
+	void run();
+
+	std::unique_ptr<bandwidth_source> source;
+	const std::chrono::milliseconds interval;
+	const size_t history;
+
+	mutable std::mutex mutex;
+	mutable std::condition_variable cv;
+	bool stop = false;
+	std::deque<std::map<size_t, double>> samples;
+	// of the last read that failed
+	std::string last_error;
+
+	std::thread thread;
+};
+
+#endif /* end of include guard: mmbwmon_passive_hpp */
@@ -0,0 +1,147 @@
+#ifndef mmbwmon_perf_counters_hpp
+#define mmbwmon_perf_counters_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/types.h>
+
+int perf_event_open(struct perf_event_attr *hw_event, pid_t pid, int cpu, int group_fd, unsigned long flags);
+
+/**
+ * Returns the directory the PMUs, CPUs and caches are read from: $MMBWMON_SYSFS, e.g.
+ * a copy of the sysfs tree of another machine, or /sys.
+ */
+std::string perf_sysfs_root();
+
+/**
+ * An event resolved from its name by perf_event_from_name().
+ */
+struct perf_event_desc {
+	perf_event_attr attr;
+	double scale = 1.0;       // of the counts to unit, from <event>.scale
+	std::string unit;         // from <event>.unit, empty if not given
+	std::vector<size_t> cpus; // the cpumask of the PMU (e.g. one CPU per package for uncore PMUs), empty for all
+};
+
+/**
+ * Resolves an event name as used by perf stat:
+ * - a generic hardware or software event, e.g. "instructions", "cache-misses", "task-clock"
+ * - "<pmu>/<event>/" for an event listed in /sys/bus/event_source/devices/<pmu>/events,
+ *   e.g. "uncore_imc_0/cas_count_read/"
+ * - "<pmu>/<term>=<value>,.../" with the terms defined in the format directory of the PMU,
+ *   e.g. "cpu/event=0x2e,umask=0x41/"
+ * Throws std::runtime_error if the event is unknown.
+ */
+perf_event_desc perf_event_from_name(const std::string &name);
+
+/**
+ * Returns the bytes one count of @p event stands for if its unit is a size
+ * (Bytes, KiB, MiB or GiB), 0 otherwise.
+ */
+double perf_event_bytes(const perf_event_desc &event);
+
+/**
+ * Counts a set of events of one PMU with one perf event group per CPU.
+ *
+ * All events of a group are scheduled together and read with a single read()
+ * using PERF_FORMAT_GROUP. If more events are opened than the PMU has counters,
+ * the kernel multiplexes the groups and the counts are scaled by the time the
+ * group was enabled over the time it was running.
+ */
+class perf_counters {
+public:
+	/**
+	 * Opens @p events (see perf_event_from_name()), which must belong to the same
+	 * PMU, on @p cpus. Without cpus the cpumask of the PMU or all online CPUs are
+	 * used. With @p cgroup (a directory in the perf_event or the unified cgroup
+	 * hierarchy) only the tasks of that cgroup are counted. The counters are
+	 * stopped. Throws std::runtime_error if an event cannot be opened.
+	 */
+	perf_counters(const std::vector<std::string> &events, const std::vector<size_t> &cpus = {},
+				  const std::string &cgroup = "");
+	~perf_counters();
+
+	perf_counters(const perf_counters &) = delete;
+	perf_counters &operator=(const perf_counters &) = delete;
+
+	/**
+	 * Starts counting, read() returns the counts since the last call.
+	 */
+	void start();
+	void stop();
+
+	/**
+	 * Returns the counts of every event on every CPU since start(), scaled for
+	 * multiplexing and indexed by [CPU index][event]. Throws std::runtime_error
+	 * if a group cannot be read.
+	 */
+	std::vector<std::vector<double>> read() const;
+
+	/**
+	 * Returns the fraction of the time since start() the least scheduled group
+	 * was counting, 1 without multiplexing.
+	 */
+	double running_fraction() const;
+
+	const std::vector<size_t> &cpus() const { return cpu_list; }
+	const perf_event_desc &event(size_t i) const { return descs[i]; }
+
+private:
+	struct group_value {
+		std::uint64_t enabled = 0, running = 0;
+		std::vector<std::uint64_t> counts;
+	};
+
+	group_value read_group(size_t group) const;
+
+	std::vector<perf_event_desc> descs;
+	std::vector<size_t> cpu_list;
+	// [CPU index][event], the first fd of a CPU is the group leader
+	std::vector<std::vector<int>> fds;
+	// values read by start()
+	std::vector<group_value> baseline;
+};
+
+/**
+ * Counts a set of events for the calling thread, read without a system call.
+ *
+ * The events are opened as one group for the calling thread and their perf
+ * pages are mapped, so read() can use rdpmc while the events are scheduled on
+ * the PMU. It falls back to read() if the PMU does not allow user space reads
+ * (see /sys/bus/event_source/devices/cpu/rdpmc) or on other architectures than
+ * x86. Must only be read by the thread that created it.
+ */
+class perf_self_counters {
+public:
+	/**
+	 * Opens @p events (see perf_event_from_name()) for the calling thread and
+	 * starts counting. Throws std::runtime_error if an event cannot be opened.
+	 */
+	explicit perf_self_counters(const std::vector<std::string> &events);
+	~perf_self_counters();
+
+	perf_self_counters(const perf_self_counters &) = delete;
+	perf_self_counters &operator=(const perf_self_counters &) = delete;
+
+	/**
+	 * Returns the counts of the events since the constructor, scaled for
+	 * multiplexing.
+	 */
+	std::vector<double> read() const;
+
+	/**
+	 * Returns true if the last read() used rdpmc for all events.
+	 */
+	bool used_rdpmc() const { return rdpmc_used; }
+
+private:
+	std::vector<int> fds;
+	std::vector<void *> pages;
+	mutable bool rdpmc_used = false;
+};
+
+#endif /* end of include guard: mmbwmon_perf_counters_hpp */
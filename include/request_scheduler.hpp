@@ -0,0 +1,109 @@
+#ifndef mmbwmon_request_scheduler_hpp
+#define mmbwmon_request_scheduler_hpp
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Sits between the MQTT requests and distgen:
+ * - requests arriving within window of the first one are handled together,
+ *   every core set is measured at most once per batch
+ * - results younger than ttl are served from a cache, by submit() on the
+ *   calling thread without waiting for the window
+ * - measurements on core sets with disjoint NUMA nodes run concurrently
+ * Core sets are compared after sorting and removing duplicates.
+ *
+ * A simulated scheduler has no thread and runs the same policy on a virtual
+ * clock, e.g. to replay a trace recorded with mmbwmon --record.
+ */
+class request_scheduler {
+public:
+	using cores_t = std::vector<size_t>;
+	using clock = std::chrono::steady_clock;
+
+	struct measurement {
+		double result;
+		double variance; // variance of result, 0 if unknown
+		double duration; // seconds spent measuring
+		double consumed; // GByte/s used by others on the NUMA nodes measured, < 0 if unknown
+	};
+
+	// runs the measurement, e.g. distgend_is_membound_set()
+	using measure_fn = std::function<measurement(const cores_t &cores)>;
+	// returns the NUMA node of a core
+	using node_fn = std::function<size_t(size_t core)>;
+	// called once per distinct core set of a batch. age is the age of the result in seconds
+	using reply_fn = std::function<void(const cores_t &cores, const measurement &result, double age)>;
+
+	request_scheduler(measure_fn measure, node_fn node_of, reply_fn reply, std::chrono::milliseconds window,
+					  std::chrono::milliseconds ttl);
+
+	/**
+	 * Creates a simulated scheduler. Requests are only handled by
+	 * advance_to(), measurements run one after the other and time passes by
+	 * the duration they report, as if the measurements of a round ran
+	 * concurrently.
+	 */
+	struct simulated_t {};
+	request_scheduler(measure_fn measure, node_fn node_of, reply_fn reply, std::chrono::milliseconds window,
+					  std::chrono::milliseconds ttl, simulated_t);
+	~request_scheduler();
+
+	request_scheduler(const request_scheduler &) = delete;
+	request_scheduler &operator=(const request_scheduler &) = delete;
+
+	void submit(cores_t cores);
+
+	/**
+	 * Simulated only: requests submitted next arrive at @p time, which must not
+	 * decrease. Handles all batches whose window closes until then.
+	 */
+	void advance_to(clock::time_point time);
+
+	/**
+	 * The time of the scheduler, in the reply callback the time the reply is
+	 * sent. Simulated schedulers may be ahead of advance_to() while they
+	 * measure.
+	 */
+	clock::time_point now() const;
+
+private:
+
+	struct cache_entry {
+		measurement result;
+		clock::time_point time;
+	};
+
+	void run();
+	void handle_batch(std::vector<cores_t> batch);
+	// the time of the scheduler thread, sim_now if simulated
+	clock::time_point current() const;
+
+	const measure_fn measure;
+	const node_fn node_of;
+	const reply_fn reply;
+	const std::chrono::milliseconds window;
+	const std::chrono::milliseconds ttl;
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool stop = false;
+	std::vector<cores_t> pending;
+
+	std::mutex cache_mutex;
+	std::map<cores_t, cache_entry> cache;
+
+	const bool simulated = false;
+	// simulated only: the time of the scheduler and of the driver, the arrival of pending.front()
+	// and the time of the reply being sent
+	clock::time_point sim_now, sim_target, first_pending, sim_reply;
+
+	std::thread thread;
+};
+
+#endif /* end of include guard: mmbwmon_request_scheduler_hpp */
@@ -0,0 +1,185 @@
+#ifndef mmbwmon_snapshot_hpp
+#define mmbwmon_snapshot_hpp
+
+/**
+ * The state mmbwmon publishes in a shared memory file (see --snapshot).
+ *
+ * This header is all a reader needs: it only depends on the standard library
+ * and POSIX. The agent changes the file under a seqlock: seq is odd while it
+ * writes, and a reader retries if seq was odd or changed while it copied.
+ * Readers never take a lock the agent waits for.
+ *
+ * Fields are only appended within a version, so a reader accepts files of
+ * its version that are at least as large as its snapshot_file. Changing an
+ * existing field requires a new version.
+ *
+ * The agent only clears pid when it stops regularly. If it was killed, the
+ * file keeps the last state and the pid, see snapshot_agent_running().
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char snapshot_default_path[] = "/dev/shm/mmbwmon";
+
+constexpr std::uint32_t snapshot_magic = 0x77626d6d; // "mmbw"
+constexpr std::uint32_t snapshot_version = 1;
+
+constexpr size_t snapshot_max_cores = 1024;
+constexpr size_t snapshot_max_nodes = 64;
+constexpr size_t snapshot_history = 64;
+
+// times are nanoseconds since the Unix epoch, 0 if not set
+inline std::int64_t snapshot_now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			   std::chrono::system_clock::now().time_since_epoch())
+		.count();
+}
+
+struct snapshot_node {
+	std::uint64_t id;
+	double peak;         // calibrated bandwidth of the node in GByte/s
+	double consumed;     // GByte/s used by others in the last measurement on this node only
+	double result;       // of that measurement
+	std::int64_t time;   // of that measurement, 0 if there was none
+};
+
+struct snapshot_result {
+	std::int64_t time;
+	double result, variance, duration, consumed; // as in the reply
+	std::uint64_t cores[snapshot_max_cores / 64]; // bitmap of the cores measured
+
+	bool has_core(size_t core) const {
+		return core < snapshot_max_cores && (cores[core / 64] >> (core % 64) & 1) != 0;
+	}
+
+	std::vector<size_t> core_list() const {
+		std::vector<size_t> res;
+		for (size_t c = 0; c < snapshot_max_cores; ++c)
+			if (has_core(c)) res.push_back(c);
+		return res;
+	}
+};
+
+struct snapshot_data {
+	std::uint64_t pid;   // of the agent, 0 after it stopped regularly
+	std::int64_t updated;
+	// distgen_mem_bw_results: GByte/s of the first i + 1 compact cores
+	std::uint64_t calibration_size;
+	double calibration[snapshot_max_cores];
+	std::uint64_t node_count;
+	snapshot_node nodes[snapshot_max_nodes];
+	// the number of results ever written, the latest is history[(results - 1) % snapshot_history]
+	std::uint64_t results;
+	snapshot_result history[snapshot_history];
+};
+
+struct snapshot_file {
+	std::uint32_t magic;
+	std::uint32_t version;
+	std::uint64_t size; // sizeof(snapshot_file) of the writer
+	std::atomic<std::uint64_t> seq;
+	snapshot_data data;
+};
+
+static_assert(std::is_trivially_copyable<snapshot_data>::value, "snapshot_data is copied while it may change");
+
+/**
+ * Whether the agent that wrote @p d still runs, i.e. pid is set and a process
+ * with that pid exists. A reader in another PID namespace cannot see the agent,
+ * and the pid of a killed agent may be reused, so readers should also check
+ * that updated is not older than they expect results to arrive.
+ */
+inline bool snapshot_agent_running(const snapshot_data &d) {
+	if (d.pid == 0) return false;
+	return kill(static_cast<pid_t>(d.pid), 0) == 0 || errno == EPERM;
+}
+
+// the results in data.history, newest first
+inline std::vector<snapshot_result> snapshot_results(const snapshot_data &data) {
+	std::vector<snapshot_result> res;
+	const std::uint64_t count = std::min<std::uint64_t>(data.results, snapshot_history);
+	for (std::uint64_t i = 1; i <= count; ++i) res.push_back(data.history[(data.results - i) % snapshot_history]);
+	return res;
+}
+
+/**
+ * Maps a snapshot file read-only.
+ */
+class snapshot_reader {
+public:
+	/**
+	 * Throws std::runtime_error if @p path cannot be mapped or is not a
+	 * snapshot file of snapshot_version.
+	 */
+	explicit snapshot_reader(const std::string &path = snapshot_default_path) {
+		const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) throw std::runtime_error("Could not open " + path);
+		struct stat st;
+		if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(snapshot_file)) {
+			close(fd);
+			throw std::runtime_error(path + " is too small for a snapshot");
+		}
+		void *p = mmap(nullptr, sizeof(snapshot_file), PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED) throw std::runtime_error("Could not map " + path);
+		file = static_cast<const snapshot_file *>(p);
+		if (file->magic != snapshot_magic || file->version != snapshot_version) {
+			munmap(p, sizeof(snapshot_file));
+			throw std::runtime_error(path + " is not a snapshot of version " + std::to_string(snapshot_version));
+		}
+	}
+
+	~snapshot_reader() { munmap(const_cast<snapshot_file *>(file), sizeof(snapshot_file)); }
+
+	snapshot_reader(const snapshot_reader &) = delete;
+	snapshot_reader &operator=(const snapshot_reader &) = delete;
+
+	/**
+	 * Returns @p f applied to a consistent state. f runs again if the agent
+	 * wrote meanwhile, so it should only copy what it needs. Throws
+	 * std::runtime_error if the agent did not finish a write within a second,
+	 * e.g. because it died while writing.
+	 */
+	template <class F> auto read(F f) const -> decltype(f(std::declval<const snapshot_data &>())) {
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+		for (size_t tries = 1;; ++tries) {
+			const std::uint64_t before = file->seq.load(std::memory_order_acquire);
+			if ((before & 1) == 0) {
+				auto res = f(file->data);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (file->seq.load(std::memory_order_relaxed) == before) return res;
+			}
+			if (tries % 1000 == 0) {
+				if (std::chrono::steady_clock::now() > deadline)
+					throw std::runtime_error("The agent did not finish writing the snapshot");
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	// a copy of the whole state
+	snapshot_data read() const {
+		return read([](const snapshot_data &d) { return d; });
+	}
+
+private:
+	const snapshot_file *file;
+};
+
+#endif /* end of include guard: mmbwmon_snapshot_hpp */
@@ -0,0 +1,43 @@
+#ifndef mmbwmon_snapshot_writer_hpp
+#define mmbwmon_snapshot_writer_hpp
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "snapshot.hpp"
+
+/**
+ * Publishes the state of the agent in a snapshot file (see snapshot.hpp).
+ * Writers are serialized by a mutex, readers are never waited for.
+ */
+class snapshot_writer {
+public:
+	/**
+	 * Creates @p path or reuses it, so readers that mapped it before keep
+	 * working. Throws std::runtime_error if it cannot be mapped or another
+	 * agent that still runs writes it.
+	 */
+	explicit snapshot_writer(const std::string &path);
+	// marks the snapshot as stale (pid 0) and keeps the file
+	~snapshot_writer();
+
+	snapshot_writer(const snapshot_writer &) = delete;
+	snapshot_writer &operator=(const snapshot_writer &) = delete;
+
+	// the bandwidth of the first i + 1 compact cores and the peak bandwidth of every node in GByte/s
+	void set_calibration(const std::vector<double> &membw, const std::map<size_t, double> &peaks);
+
+	// a measurement of @p cores on @p nodes, also the latest one of the node if there is only one
+	void add_result(const std::vector<size_t> &cores, const std::vector<size_t> &nodes, double result,
+					double variance, double duration, double consumed);
+
+private:
+	template <class F> void update(F f);
+
+	snapshot_file *file;
+	std::mutex mutex;
+};
+
+#endif /* end of include guard: mmbwmon_snapshot_writer_hpp */
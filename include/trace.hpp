@@ -0,0 +1,90 @@
+#ifndef mmbwmon_trace_hpp
+#define mmbwmon_trace_hpp
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "request_scheduler.hpp"
+
+/**
+ * A binary trace of the request handling of mmbwmon (see --record), replayed
+ * by the replay tool. The file starts with trace_header, followed by records.
+ * Integers and doubles are stored in host byte order, so traces are only
+ * portable between hosts of the same endianness.
+ */
+struct trace_header {
+	std::uint64_t window_ms;       // --coalesce-window of the agent
+	std::uint64_t ttl_ms;          // --cache-ttl of the agent
+	std::vector<std::uint32_t> nodes; // NUMA node of every core
+};
+
+struct trace_record {
+	enum kind_t : std::uint8_t {
+		message,     // a request as received, YAML or binary
+		measurement, // a result of the measurement function of the scheduler
+		reply,       // a result sent by the scheduler
+	};
+
+	kind_t kind;
+	std::uint64_t time_ns; // since the trace started
+	std::string payload;   // message only
+	request_scheduler::cores_t cores;
+	request_scheduler::measurement result; // measurement and reply only
+	double age;                            // reply only
+};
+
+class trace_writer {
+public:
+	/**
+	 * Creates @p path and writes @p header. Throws std::runtime_error if the
+	 * file cannot be written.
+	 */
+	trace_writer(const std::string &path, const trace_header &header);
+
+	trace_writer(const trace_writer &) = delete;
+	trace_writer &operator=(const trace_writer &) = delete;
+
+	// the records are stamped with the time since the constructor and flushed, this is threadsafe
+	void message(const std::string &payload);
+	void measurement(const request_scheduler::cores_t &cores, const request_scheduler::measurement &result);
+	void reply(const request_scheduler::cores_t &cores, const request_scheduler::measurement &result, double age);
+
+	// writes @p record with the time it has, e.g. to synthesize a trace
+	void write(const trace_record &record);
+
+private:
+	// nanoseconds since the constructor
+	std::uint64_t elapsed() const;
+
+	std::mutex mutex;
+	std::ofstream out;
+	const std::chrono::steady_clock::time_point start;
+};
+
+class trace_reader {
+public:
+	/**
+	 * Opens @p path and reads its header. Throws std::runtime_error if it is
+	 * not a trace.
+	 */
+	explicit trace_reader(const std::string &path);
+
+	const trace_header &header() const { return head; }
+
+	/**
+	 * Reads the next record, returns false at the end of the trace. Throws
+	 * std::runtime_error if the record is truncated or unknown, which may
+	 * only happen at the end of the trace of an agent that got killed.
+	 */
+	bool next(trace_record &record);
+
+private:
+	std::ifstream in;
+	trace_header head;
+};
+
+#endif /* end of include guard: mmbwmon_trace_hpp */
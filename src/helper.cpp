@@ -5,3 +5,4 @@
 /*** config vars **/
 std::string server;
 size_t port = 1883;
+std::string local_socket;
@@ -0,0 +1,22 @@
+#include "info_file.hpp"
+
+#include <cmath>
+
+bool info_matches(const fast::msg::agent::mmbwmon::system_info &info, const distgend_initT &init, size_t buffer_size,
+				  const distgend_placementT &placement) {
+	if (info.smt != init.SMT_factor) return false;
+	if (info.buffer_size != 0 && info.buffer_size != buffer_size) return false;
+	if (info.page_size == 0) return true;
+	return info.page_size == placement.page_size && (info.local_fraction < 0.0) == (placement.local_fraction < 0.0) &&
+		   std::abs(info.local_fraction - placement.local_fraction) < 0.1;
+}
+
+bool restore_legacy_info(fast::msg::agent::mmbwmon::system_info info, const distgend_initT &init) {
+	if (!info.curves.empty() || info.membw.empty()) return false;
+	if (info.threads != init.number_of_threads || info.numa != init.NUMA_domains) return false;
+
+	// distgen is initialized already, only the results are set
+	if (info.membw.size() < distgend_get_core_count()) info.membw.resize(distgend_get_core_count(), 0.0);
+	distgend_set_measured_idle_bandwidth(&info.membw[0]);
+	return true;
+}
@@ -1,51 +1,121 @@
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
 #include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
-#include <cstring>
 
 #include <pwd.h> // for getpwuid()
 
-// for perf support
-#include <linux/perf_event.h>
-#include <sys/ioctl.h>
-#include <syscall.h>
-
 #include <distgen/distgen.h>
 
 #include <fast-lib/message/agent/mmbwmon/ack.hpp>
+#include <fast-lib/message/agent/mmbwmon/latency_reply.hpp>
+#include <fast-lib/message/agent/mmbwmon/latency_request.hpp>
 #include <fast-lib/message/agent/mmbwmon/reply.hpp>
 #include <fast-lib/message/agent/mmbwmon/request.hpp>
 #include <fast-lib/message/agent/mmbwmon/restart.hpp>
 #include <fast-lib/message/agent/mmbwmon/stop.hpp>
 #include <fast-lib/message/agent/mmbwmon/system_info.hpp>
+#include <fast-lib/message/agent/mmbwmon/throttle.hpp>
+#include <fast-lib/message/agent/mmbwmon/throttle_reply.hpp>
+#include <fast-lib/local_communicator.hpp>
 #include <fast-lib/mqtt_communicator.hpp>
 
 #ifdef CGROUP_SUPPORT
 #include <ponci/ponci.hpp>
+#include <ponri/ponri.hpp>
 #endif
 
 #include "helper.hpp"
+#include "info_file.hpp"
+#include "passive.hpp"
+#include "perf_counters.hpp"
+#include "request_scheduler.hpp"
+#include "snapshot_writer.hpp"
+#include "trace.hpp"
 
 const std::string home_dir = std::string(getpwuid(getuid())->pw_dir) + "/.mmbwmon";
 
 /*** config vars **/
 static distgend_initT distgen_init;
 static bool measure_only = false;
+static bool sweep = false;
+static bool measure_interference = true;
 static bool home_dir_available = false;
+static size_t passive_interval_ms = 0;
+static size_t passive_history = 10;
+static std::string passive_source = "auto";
+static size_t coalesce_window_ms = 20;
+static size_t cache_ttl_ms = 1000;
+static size_t throttle_interval_ms = 1000;
+static double buffer_idle_s = 60.0;
+static bool prewarm = false;
+static std::string snapshot_path = snapshot_default_path;
+static std::string record_path;
+// adaptive probes, off if probe.tolerance is 0
+static distgend_probeT probe = {0.0, 1.0, 3};
+
+// only set in passive mode
+static std::unique_ptr<passive_monitor> monitor;
+// not set with --snapshot none
+static std::unique_ptr<snapshot_writer> snapshot;
+// only set with --record
+static std::unique_ptr<trace_writer> recorder;
+
+// names of the calibration curves in the info file, indexed by distgend_curveT
+static const char *const curve_names[DISTGEN_CURVES] = {"compact", "spread", "smt"};
+// names of the loads in the info file, indexed by distgend_loadT
+static const char *const load_names[DISTGEN_LOADS] = {"read", "write", "mixed"};
+
+// bandwidth measurements share the system, a latency measurement needs it exclusively
+static std::shared_timed_mutex measure_mutex;
+
+// contents of the info file, updated while the calibration runs
+static fast::msg::agent::mmbwmon::system_info stored_info;
+static std::mutex stored_info_mutex;
 
 [[noreturn]] static void print_help(const char *argv) {
 	std::cout << argv << " supports the following flags:\n";
-	std::cout << "\t --server \t URI of the MQTT broker. \t\t\t Required!\n";
+	std::cout << "\t --server \t URI of the MQTT broker. \t\t\t Required without --local!\n";
 	std::cout << "\t --port \t Port of the MQTT broker. \t\t\t Default: 1883\n";
-	std::cout << "\t --numa \t Number of NUMA domains. \t\t\t Default: 2\n";
-	std::cout << "\t --threads \t Number of logical cores. \t\t\t Default: " << std::thread::hardware_concurrency()
-			  << "\n";
-	std::cout << "\t --smt \t\t Number of logical cores per physical core. \t Default: 2\n";
+	std::cout << "\t --local \t Serve node-local clients on the Unix socket <path> instead of MQTT. Default: off\n";
+	std::cout << "\t --numa \t Number of NUMA domains. \t\t\t Default: detected\n";
+	std::cout << "\t --threads \t Number of logical cores. \t\t\t Default: detected\n";
+	std::cout << "\t --smt \t\t Number of logical cores per physical core. \t Default: detected\n";
+	std::cout << "\t --hugepages \t Pages of the benchmark buffers (none, thp, hugetlb). Default: none\n";
+	std::cout << "\t --llc-multiple \t Benchmark buffer size as a multiple of the last level cache. Default: 4\n";
+	std::cout << "\t --buffer-size \t Benchmark buffer size per thread in MB. \t Default: based on the LLC\n";
+	std::cout << "\t --buffer-idle \t Release benchmark buffers unused for <s> seconds, < 0 keeps them. Default: 60\n";
+	std::cout << "\t --prewarm \t Keep the buffers of the compact calibration cores allocated. \t Default: false\n";
+	std::cout << "\t --snapshot \t Publish the results in the shared memory file <path>, none to disable. Default: "
+			  << snapshot_default_path << "\n";
+	std::cout << "\t --tenant \t Load assumed for the other applications (read, write, mixed). Default: mixed\n";
+	std::cout << "\t --no-interference Do not measure the interference between loads. \t Default: false\n";
+	std::cout << "\t --passive \t Answer requests from memory controller counters sampled every <ms> instead of "
+				 "running distgen. Default: off\n";
+	std::cout << "\t --passive-source Counters used in passive mode (auto, imc, mbm, file:<dir>). Default: auto\n";
+	std::cout << "\t --passive-history Number of samples averaged in passive mode. \t Default: 10\n";
+	std::cout << "\t --coalesce-window Requests arriving within <ms> are handled together. \t Default: 20\n";
+	std::cout << "\t --cache-ttl \t Results younger than <ms> are reused. \t\t Default: 1000\n";
+	std::cout << "\t --throttle-interval Throttled groups are checked against their cap every <ms>. Default: 1000\n";
+	std::cout << "\t --tolerance \t Measure until the 95% confidence interval is within +-<fraction> instead of running "
+				 "a fixed number of iterations. Default: off\n";
+	std::cout << "\t --probe-budget \t Time limit of a measurement with --tolerance in <ms>. \t Default: 1000\n";
+	std::cout << "\t --record \t Write requests, measurements and replies to the trace <path>. Default: off\n";
 	std::cout << "\t --measure-only  Only runs the initialization measurements. \t Default: false\n";
+	std::cout << "\t --sweep \t Only measures the bandwidth for various buffer sizes. \t Default: false\n";
 	exit(0);
 }
 
@@ -53,9 +123,13 @@ static void parse_options(size_t argc, const char **argv) {
 	if (argc == 1) {
 		print_help(argv[0]);
 	}
-	distgen_init.number_of_threads = std::thread::hardware_concurrency();
-	distgen_init.NUMA_domains = 2;
-	distgen_init.SMT_factor = 2;
+	// the flags below overwrite the detected topology
+	if (distgend_detect_topology(&distgen_init) != 0) {
+		std::cerr << "Could not detect the CPU topology, assuming 2 NUMA domains and SMT 2." << std::endl;
+		distgen_init.number_of_threads = std::thread::hardware_concurrency();
+		distgen_init.NUMA_domains = 2;
+		distgen_init.SMT_factor = 2;
+	}
 
 	for (size_t i = 1; i < argc; ++i) {
 		std::string arg(argv[i]);
@@ -100,16 +174,174 @@ static void parse_options(size_t argc, const char **argv) {
 			++i;
 			continue;
 		}
+		if (arg == "--hugepages") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			const std::string pages(argv[i + 1]);
+			if (pages == "none") {
+				distgend_set_pages(DISTGEN_PAGES_DEFAULT);
+			} else if (pages == "thp") {
+				distgend_set_pages(DISTGEN_PAGES_THP);
+			} else if (pages == "hugetlb") {
+				distgend_set_pages(DISTGEN_PAGES_HUGETLB);
+			} else {
+				print_help(argv[0]);
+			}
+			++i;
+			continue;
+		}
+		if (arg == "--llc-multiple") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			distgend_set_llc_multiple(std::stod(std::string(argv[i + 1])));
+			++i;
+			continue;
+		}
+		if (arg == "--buffer-size") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			distgend_set_buffer_size(std::stoul(std::string(argv[i + 1])) * 1000 * 1000);
+			++i;
+			continue;
+		}
+		if (arg == "--tenant") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			const std::string tenant(argv[i + 1]);
+			if (tenant == "read") {
+				distgend_set_tenant(DISTGEN_LOAD_READ);
+			} else if (tenant == "write") {
+				distgend_set_tenant(DISTGEN_LOAD_WRITE);
+			} else if (tenant == "mixed") {
+				distgend_set_tenant(DISTGEN_LOAD_MIXED);
+			} else {
+				print_help(argv[0]);
+			}
+			++i;
+			continue;
+		}
+		if (arg == "--no-interference") {
+			measure_interference = false;
+			continue;
+		}
+		if (arg == "--passive") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			passive_interval_ms = std::stoul(std::string(argv[i + 1]));
+			++i;
+			continue;
+		}
+		if (arg == "--passive-source") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			passive_source = std::string(argv[i + 1]);
+			++i;
+			continue;
+		}
+		if (arg == "--passive-history") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			passive_history = std::stoul(std::string(argv[i + 1]));
+			++i;
+			continue;
+		}
+		if (arg == "--coalesce-window") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			coalesce_window_ms = std::stoul(std::string(argv[i + 1]));
+			++i;
+			continue;
+		}
+		if (arg == "--cache-ttl") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			cache_ttl_ms = std::stoul(std::string(argv[i + 1]));
+			++i;
+			continue;
+		}
+		if (arg == "--throttle-interval") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			throttle_interval_ms = std::max(1ul, std::stoul(std::string(argv[i + 1])));
+			++i;
+			continue;
+		}
+		if (arg == "--tolerance") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			probe.tolerance = std::stod(std::string(argv[i + 1]));
+			++i;
+			continue;
+		}
+		if (arg == "--probe-budget") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			probe.max_time = std::stoul(std::string(argv[i + 1])) / 1000.0;
+			++i;
+			continue;
+		}
+		if (arg == "--buffer-idle") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			buffer_idle_s = std::stod(std::string(argv[i + 1]));
+			++i;
+			continue;
+		}
+		if (arg == "--snapshot") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			snapshot_path = std::string(argv[i + 1]);
+			++i;
+			continue;
+		}
+		if (arg == "--record") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			record_path = std::string(argv[i + 1]);
+			++i;
+			continue;
+		}
+		if (arg == "--prewarm") {
+			prewarm = true;
+			continue;
+		}
 		if (arg == "--measure-only") {
 			measure_only = true;
 			continue;
 		}
+		if (arg == "--sweep") {
+			sweep = true;
+			continue;
+		}
+		if (arg == "--local") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			local_socket = std::string(argv[i + 1]);
+			++i;
+			continue;
+		}
 	}
 
-	if (server == "" && !measure_only) print_help(argv[0]);
+	if (server == "" && local_socket == "" && !measure_only && !sweep) print_help(argv[0]);
 }
 
-static void write_gnuplot_file(distgend_initT distgen_init) {
+static void write_gnuplot_file() {
 	std::ofstream gnuplot_file;
 	if (!home_dir_available) {
 		return;
@@ -124,31 +356,37 @@ static void write_gnuplot_file(distgend_initT distgen_init) {
 
 	gnuplot_file << "#cores measured calculated" << std::endl;
 
-	distgend_configT config;
-	for (unsigned char i = 0; i < distgen_init.number_of_threads / distgen_init.SMT_factor; ++i) {
+	std::vector<size_t> cores;
+	for (size_t i = 0; i < distgend_get_core_count(); ++i) {
 		gnuplot_file << std::to_string(i + 1) + " ";
 		gnuplot_file << std::to_string(distgend_get_measured_idle_bandwidth(i + 1)) + " ";
 
-		config.number_of_threads = i + 1;
-		config.threads_to_use[i] = i;
-		gnuplot_file << std::to_string(distgend_get_max_bandwidth(config)) + "\n";
+		cores.push_back(distgend_get_compact_thread(i));
+		gnuplot_file << std::to_string(distgend_get_max_bandwidth_set({cores.size(), cores.data()})) + "\n";
 	}
 
 	gnuplot_file.close();
 }
 
-static void write_yaml_file(distgend_initT distgen_init) {
+// the NUMA nodes used by distgen
+static std::set<size_t> numa_nodes() {
+	std::set<size_t> res;
+	for (size_t t = 0; t < distgen_init.number_of_threads; ++t) res.insert(distgend_get_cpu(t).node);
+	return res;
+}
+
+// the percentiles of l as stored in the info file and sent in replies
+static std::map<std::string, double> latency_to_map(const distgend_latencyT &l) {
+	return {{"min", l.min}, {"p50", l.p50}, {"p90", l.p90}, {"p99", l.p99},
+			{"p999", l.p999}, {"max", l.max}, {"mean", l.mean}};
+}
+
+// must be called with stored_info_mutex held
+static void write_info_file(const fast::msg::agent::mmbwmon::system_info &info) {
 	if (!home_dir_available) {
 		return;
 	}
 
-	std::vector<double> membw;
-	for (unsigned char i = 0; i < distgen_init.number_of_threads / distgen_init.SMT_factor; ++i) {
-		membw.push_back(distgend_get_measured_idle_bandwidth(i + 1));
-	}
-
-	fast::msg::agent::mmbwmon::system_info info(distgen_init.number_of_threads, distgen_init.SMT_factor,
-												distgen_init.NUMA_domains, membw);
 	std::ofstream info_file;
 	std::string filename(home_dir + "/" + get_hostname() + ".info");
 	info_file.open(filename, std::ios::trunc);
@@ -160,19 +398,91 @@ static void write_yaml_file(distgend_initT distgen_init) {
 	}
 }
 
+// stores a point of the calibration, so an interrupted calibration can resume
+static void checkpoint(size_t node, distgend_curveT curve, size_t cores, double bandwidth, void * /*arg*/) {
+	std::lock_guard<std::mutex> lock(stored_info_mutex);
+	stored_info.curves[node][curve_names[curve]][cores - 1] = bandwidth;
+	write_info_file(stored_info);
+}
+
+static void write_yaml_file() {
+	std::lock_guard<std::mutex> lock(stored_info_mutex);
+
+	stored_info.membw.clear();
+	for (size_t i = 0; i < distgend_get_core_count(); ++i) {
+		stored_info.membw.push_back(distgend_get_measured_idle_bandwidth(i + 1));
+	}
+	for (size_t node : numa_nodes()) {
+		for (int c = 0; c < DISTGEN_CURVES; ++c) {
+			auto &curve = stored_info.curves[node][curve_names[c]];
+			for (size_t k = 0; k < curve.size(); ++k) {
+				curve[k] = distgend_get_curve(node, static_cast<distgend_curveT>(c), k + 1);
+			}
+		}
+	}
+
+	std::vector<distgend_interferenceT> table(distgend_get_interference(nullptr, 0));
+	distgend_get_interference(table.data(), table.size());
+	stored_info.interference.clear();
+	for (const auto &e : table) {
+		stored_info.interference[load_names[e.load]].push_back(
+			{static_cast<double>(e.node_cores), static_cast<double>(e.probe_cores), static_cast<double>(e.load_cores),
+			 e.ratio, e.consumed});
+	}
+
+	stored_info.idle_latency.clear();
+	for (size_t node : numa_nodes()) {
+		const distgend_latencyT l = distgend_get_idle_latency(node);
+		if (l.samples == 0) continue;
+		stored_info.idle_latency[node] = latency_to_map(l);
+		stored_info.idle_latency[node]["samples"] = static_cast<double>(l.samples);
+	}
+
+	write_info_file(stored_info);
+}
+
+// prints the allocated benchmark buffers and the resident set size of the agent
+static void print_buffers(const distgend_buffersT &buffers) {
+	std::cout << buffers.buffers << " buffers (" << buffers.pinned << " pre-warmed, " << buffers.bytes / 1000 / 1000
+			  << " MB) allocated, RSS " << resident_bytes() / 1000 / 1000 << " MB" << std::endl;
+}
+
 static void print_distgen_results(distgend_initT distgen_init) {
-	assert(distgen_init.number_of_threads / distgen_init.SMT_factor - 1 < DISTGEN_MAXTHREADS);
+	const distgend_placementT placement = distgend_get_placement();
+	std::cout << "buffers: " << distgend_get_buffer_size() / 1000 / 1000 << " MB per thread, page size "
+			  << placement.page_size / 1024 << " KiB, ";
+	if (placement.local_fraction < 0.0) {
+		std::cout << "NUMA placement unknown" << std::endl;
+	} else {
+		std::cout << placement.local_fraction * 100.0 << "% of pages NUMA local"
+				  << (placement.numa_bound ? "" : " (not bound)") << std::endl;
+	}
+	print_buffers(distgend_get_buffers());
 
-	distgend_configT config;
+	for (size_t node : numa_nodes()) {
+		std::cout << "NUMA node " << node << "\ncores\t\tcompact (GByte/s)\tspread (GByte/s)\tSMT (GByte/s)"
+				  << std::endl;
+		for (size_t k = 1; k <= distgend_get_node_cores(node); ++k) {
+			std::cout << k << "\t\t" << distgend_get_curve(node, DISTGEN_CURVE_COMPACT, k) << "\t\t\t"
+					  << distgend_get_curve(node, DISTGEN_CURVE_SPREAD, k) << "\t\t\t"
+					  << distgend_get_curve(node, DISTGEN_CURVE_SMT, k) << std::endl;
+		}
+		const distgend_latencyT l = distgend_get_idle_latency(node);
+		if (l.samples > 0) {
+			std::cout << "idle latency (ns): p50 " << l.p50 << ", p90 " << l.p90 << ", p99 " << l.p99 << ", max "
+					  << l.max << std::endl;
+		}
+	}
+
+	std::vector<size_t> cores;
 	std::string gnuplot_data;
 
 	std::cout << "threads\t\tmeasured (GByte/s)\tcalculated (GByte/s)" << std::endl;
-	for (unsigned char i = 0; i < distgen_init.number_of_threads / distgen_init.SMT_factor; ++i) {
-		config.number_of_threads = i + 1;
-		config.threads_to_use[i] = i;
+	for (size_t i = 0; i < distgend_get_core_count(); ++i) {
+		cores.push_back(distgend_get_compact_thread(i));
 
 		auto dgen_measured = distgend_get_measured_idle_bandwidth(i + 1);
-		auto dgen_computed_max = distgend_get_max_bandwidth(config);
+		auto dgen_computed_max = distgend_get_max_bandwidth_set({cores.size(), cores.data()});
 
 		std::cout << i + 1 << "\t\t" << dgen_measured << "\t\t\t" << dgen_computed_max << std::endl;
 
@@ -196,71 +506,631 @@ static void print_distgen_results(distgend_initT distgen_init) {
 	}
 }
 
-[[noreturn]] static void bench_thread(fast::MQTT_communicator &comm) {
+// the calibrated peak bandwidth of every NUMA node in GByte/s
+static const std::map<size_t, double> &node_peaks() {
+	static const auto res = [] {
+		std::map<size_t, std::vector<size_t>> node_threads;
+		for (size_t t = 0; t < distgen_init.number_of_threads; ++t) node_threads[distgend_get_cpu(t).node].push_back(t);
+
+		std::map<size_t, double> peaks;
+		for (const auto &n : node_threads)
+			peaks[n.first] = distgend_get_max_bandwidth_set({n.second.size(), n.second.data()});
+		return peaks;
+	}();
+	return res;
+}
+
+// estimates distgend_is_membound_set() from the bandwidth measured by monitor
+static request_scheduler::measurement passive_measure(const std::vector<size_t> &cores) {
+	std::set<size_t> nodes;
+	for (auto c : cores) nodes.insert(distgend_get_cpu(c).node);
+
+	// the bandwidth left on the nodes used by cores
+	const auto used = monitor->bandwidth();
+	double available = 0.0, consumed = 0.0;
+	for (auto n : nodes) {
+		const double peak = node_peaks().at(n);
+		const auto it = used.find(n);
+		const double node_used = (it != used.end() ? it->second : 0.0);
+		available += std::max(0.0, peak - node_used);
+		consumed += node_used;
+	}
+
+	const double max = distgend_get_max_bandwidth_set({cores.size(), cores.data()});
+	return request_scheduler::measurement{std::min(1.0, available / max), 0.0, 0.0, consumed};
+}
+
+// runs one measurement for the request scheduler
+static request_scheduler::measurement bench_measure(const request_scheduler::cores_t &cores) {
+	std::cout << "Running bench on cores ";
+	for (auto c : cores) std::cout << c << ", ";
+	std::cout << "\n";
+
+	const distgend_cpusetT set{cores.size(), cores.data()};
+	if (monitor) return passive_measure(cores);
+
+	std::shared_lock<std::shared_timed_mutex> lock(measure_mutex);
+	const double wait = distgend_get_buffers().wait;
+	request_scheduler::measurement m;
+	if (probe.tolerance > 0.0) {
+		const distgend_estimateT e = distgend_probe_membound_set(set, probe);
+		m = request_scheduler::measurement{e.value, e.variance, e.duration,
+										   distgend_get_consumed_bandwidth_set(set, e.value)};
+	} else {
+		const auto start = std::chrono::steady_clock::now();
+		const double res = distgend_is_membound_set(set);
+		const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+		m = request_scheduler::measurement{res, 0.0, duration.count(),
+										   distgend_get_consumed_bandwidth_set(set, res)};
+	}
+
+	// the first measurement of a core waits for its buffer
+	const distgend_buffersT buffers = distgend_get_buffers();
+	if (buffers.wait > wait) {
+		std::cout << "First probe waited " << (buffers.wait - wait) * 1000.0 << " ms for buffers, ";
+		print_buffers(buffers);
+	}
+	return m;
+}
+
+[[noreturn]] static void bench_thread(fast::Communicator &comm) {
+	// the (id, encoding) of the requests waiting for a core set (true = binary).
+	// Requests arriving while their core set is measured get the reply of that
+	// measurement, which is sent once per id and encoding requested up to then;
+	// requests without id (0) share one reply per encoding. A core set is only
+	// submitted to the scheduler if no request waits for it yet.
+	std::map<request_scheduler::cores_t, std::set<std::pair<std::uint64_t, bool>>> waiting;
+	std::mutex waiting_mutex;
+
+	request_scheduler scheduler(
+		[](const request_scheduler::cores_t &cores) {
+			const request_scheduler::measurement m = bench_measure(cores);
+			if (recorder) recorder->measurement(cores, m);
+			return m;
+		},
+		[](size_t core) { return distgend_get_cpu(core).node; },
+		[&comm, &waiting, &waiting_mutex](const request_scheduler::cores_t &cores,
+										  const request_scheduler::measurement &m, double age) {
+			std::set<std::pair<std::uint64_t, bool>> requesters;
+			{
+				std::lock_guard<std::mutex> lock(waiting_mutex);
+				const auto it = waiting.find(cores);
+				if (it != waiting.end()) {
+					requesters.swap(it->second);
+					waiting.erase(it);
+				}
+			}
+
+			// cached results were published when they were measured
+			if (snapshot && age == 0.0) {
+				std::set<size_t> nodes;
+				for (auto c : cores) nodes.insert(distgend_get_cpu(c).node);
+				snapshot->add_result(cores, {nodes.begin(), nodes.end()}, m.result, m.variance, m.duration, m.consumed);
+			}
+
+			// the waiters got the reply of an earlier measurement
+			if (requesters.empty()) return;
+
+			if (recorder) recorder->reply(cores, m, age);
+
+			fast::msg::agent::mmbwmon::reply reply(cores, m.result, age, m.variance, m.duration, m.consumed);
+			std::cout << "Sending message to " << requesters.size() << " requester(s):\n" << reply.to_string() << "\n";
+			for (const auto &r : requesters) {
+				reply.id = r.first;
+				comm.send_message(r.second ? reply.to_binary() : reply.to_string(), baseTopic + "/response");
+			}
+		},
+		std::chrono::milliseconds(coalesce_window_ms), std::chrono::milliseconds(cache_ttl_ms));
+
 	while (true) {
 		fast::msg::agent::mmbwmon::request req;
 		auto m = comm.get_message();
-		std::cout << "Got message:\n" << m << "\n";
-		req.from_string(m);
+		if (recorder) recorder->message(m);
+		const bool binary = fast::binary::is_binary(m);
+		// binary messages are not printable
+		std::cout << "Got message:\n" << (binary ? "<binary>" : m) << "\n";
+		try {
+			req.from_string(m);
+		} catch (const std::exception &e) {
+			std::cerr << "Ignoring malformed request: " << e.what() << std::endl;
+			continue;
+		}
 
-		std::cout << "Running bench on cores ";
+		bool valid = !req.cores.empty();
+		for (auto c : req.cores) valid &= (c < distgen_init.number_of_threads);
+		if (!valid) {
+			std::cerr << "Ignoring request with invalid cores." << std::endl;
+			continue;
+		}
 
-		distgend_configT dc;
-		dc.number_of_threads = req.cores.size();
-		for (size_t i = 0; i < req.cores.size(); ++i) {
-			dc.threads_to_use[i] = static_cast<unsigned char>(req.cores[i]);
-			std::cout << static_cast<int>(dc.threads_to_use[i]) << ", ";
+		// the scheduler identifies core sets by their sorted cores
+		request_scheduler::cores_t cores = req.cores;
+		std::sort(cores.begin(), cores.end());
+		cores.erase(std::unique(cores.begin(), cores.end()), cores.end());
+		bool queued;
+		{
+			std::lock_guard<std::mutex> lock(waiting_mutex);
+			auto &requesters = waiting[cores];
+			// the others get the reply of the measurement already queued or running
+			queued = !requesters.empty();
+			requesters.emplace(req.id, binary);
 		}
 
-		std::cout << "\n";
+		if (!queued) scheduler.submit(std::move(cores));
+	}
+}
 
-		const double mem = distgend_is_membound(dc);
+// releases the buffers not used for buffer_idle_s
+[[noreturn]] static void buffer_thread() {
+	const auto interval = std::chrono::duration<double>(std::max(buffer_idle_s / 4.0, 0.1));
+	while (true) {
+		std::this_thread::sleep_for(interval);
+
+		// unmapping shoots down TLB entries of all CPUs, which distorts latency measurements
+		std::shared_lock<std::shared_timed_mutex> lock(measure_mutex);
+		const size_t released = distgend_release_idle_buffers();
+		lock.unlock();
+		if (released > 0) {
+			std::cout << "Released " << released << " idle buffers, ";
+			print_buffers(distgend_get_buffers());
+		}
+	}
+}
+
+[[noreturn]] static void latency_thread(fast::Communicator &comm) {
+	comm.add_subscription(baseTopic + "/latency");
+	while (true) {
+		fast::msg::agent::mmbwmon::latency_request req;
+		auto m = comm.get_message(baseTopic + "/latency");
+		// binary messages are not printable
+		std::cout << "Got message:\n" << (fast::binary::is_binary(m) ? "<binary>" : m) << "\n";
+		try {
+			req.from_string(m);
+		} catch (const std::exception &e) {
+			std::cerr << "Ignoring malformed request: " << e.what() << std::endl;
+			continue;
+		}
+
+		// a core loaded twice would be a second worker on the same pool thread
+		std::sort(req.load_cores.begin(), req.load_cores.end());
+		req.load_cores.erase(std::unique(req.load_cores.begin(), req.load_cores.end()), req.load_cores.end());
+
+		const auto load = std::find(std::begin(load_names), std::end(load_names), req.load_type);
+		bool valid = req.core < distgen_init.number_of_threads && load != std::end(load_names) && req.duration > 0.0;
+		for (auto c : req.load_cores) valid &= (c < distgen_init.number_of_threads && c != req.core);
+		if (!valid) {
+			std::cerr << "Ignoring latency request with invalid cores or load." << std::endl;
+			continue;
+		}
 
-		std::cout << "Result: " << mem << std::endl;
+		distgend_latencyT l;
+		{
+			std::unique_lock<std::shared_timed_mutex> lock(measure_mutex);
+			l = distgend_loaded_latency_set(req.core, {req.load_cores.size(), req.load_cores.data()},
+											static_cast<distgend_loadT>(load - std::begin(load_names)), req.duration);
+		}
 
-		fast::msg::agent::mmbwmon::reply reply(req.cores, mem);
+		const distgend_latencyT idle = distgend_get_idle_latency(distgend_get_cpu(req.core).node);
+		fast::msg::agent::mmbwmon::latency_reply reply(
+			req.core, req.load_cores, req.load_type, latency_to_map(l), l.samples,
+			idle.samples > 0 ? latency_to_map(idle) : std::map<std::string, double>());
 		std::cout << "Sending message:\n" << reply.to_string() << "\n";
-		comm.send_message(reply.to_string(), baseTopic + "/response");
+		comm.send_message(reply.to_string(), baseTopic + "/latency/response");
 	}
 }
 
 #ifdef CGROUP_SUPPORT
-[[noreturn]] static void stop_thread(fast::MQTT_communicator &comm) {
-	comm.add_subscription(baseTopic + "/stop");
+// how long stop/restart wait for the cgroup to reach the requested state before acking
+static constexpr std::chrono::milliseconds cgroup_wait_timeout(1000);
+// the number of cgroups whose freezer files are kept open
+static constexpr size_t max_cgroup_handles = 256;
+
+using cgroup_handles = std::map<std::string, std::unique_ptr<cgroup_handle>>;
+
+// freezes or thaws cgroup and waits until all tasks are frozen/thawed. Returns
+// the seconds since start, or -1 if this did not happen within cgroup_wait_timeout.
+static double set_frozen(cgroup_handles &handles, const std::string &cgroup, bool frozen,
+						 std::chrono::steady_clock::time_point start) {
+	if (handles.size() >= max_cgroup_handles && handles.count(cgroup) == 0) handles.clear();
+
+	auto &h = handles[cgroup];
+	for (int attempt = 0;; ++attempt) {
+		try {
+			if (!h) h.reset(new cgroup_handle(cgroup));
+			if (frozen)
+				h->freeze();
+			else
+				h->thaw();
+			break;
+		} catch (const std::exception &) {
+			// the cgroup may have been recreated since its files were opened
+			h.reset();
+			if (attempt > 0) {
+				handles.erase(cgroup);
+				throw;
+			}
+		}
+	}
+
+	if (!(frozen ? h->wait_frozen(cgroup_wait_timeout) : h->wait_thawed(cgroup_wait_timeout))) return -1.0;
+	const std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+	return d.count();
+}
+
+// handles stop (frozen = true) or restart requests on topic and acks them on topic/ack
+[[noreturn]] static void freezer_thread(fast::Communicator &comm, const std::string &topic, bool frozen) {
+	cgroup_handles handles;
+	comm.add_subscription(topic);
 	while (true) {
-		fast::msg::agent::mmbwmon::stop req;
-		auto m = comm.get_message(baseTopic + "/stop");
+		auto m = comm.get_message(topic);
+		const auto start = std::chrono::steady_clock::now();
 		std::cout << "Got message:\n" << m << "\n";
-		req.from_string(m);
 
-		cgroup_freeze(req.cgroup);
+		std::string cgroup;
+		try {
+			if (frozen) {
+				fast::msg::agent::mmbwmon::stop req;
+				req.from_string(m);
+				cgroup = req.cgroup;
+			} else {
+				fast::msg::agent::mmbwmon::restart req;
+				req.from_string(m);
+				cgroup = req.cgroup;
+			}
+		} catch (const std::exception &e) {
+			std::cerr << "Ignoring malformed request: " << e.what() << std::endl;
+			continue;
+		}
+
+		double duration;
+		try {
+			duration = set_frozen(handles, cgroup, frozen, start);
+		} catch (const std::exception &e) {
+			std::cerr << "Could not " << (frozen ? "freeze " : "thaw ") << cgroup << ": " << e.what() << std::endl;
+			continue;
+		}
+		if (duration < 0.0)
+			std::cerr << cgroup << " is not " << (frozen ? "frozen" : "thawed") << " after "
+					  << cgroup_wait_timeout.count() << " ms, acking anyway." << std::endl;
+		else
+			std::cout << (frozen ? "Froze " : "Thawed ") << cgroup << " in " << duration * 1e6 << " us\n";
+
+		fast::msg::agent::mmbwmon::ack a(duration);
+		comm.send_message(a.to_string(), topic + "/ack");
+	}
+}
 
-		fast::msg::agent::mmbwmon::ack a;
-		comm.send_message(a.to_string(), baseTopic + "/stop/ack");
+[[noreturn]] static void stop_thread(fast::Communicator &comm) { freezer_thread(comm, baseTopic + "/stop", true); }
+
+[[noreturn]] static void restart_thread(fast::Communicator &comm) { freezer_thread(comm, baseTopic + "/restart", false); }
+
+// the MBA values the hardware offers, read when the first throttle request arrives
+struct mba_range {
+	// false if MBA is not available
+	bool available;
+	// values are MByte/s instead of percent (mba_MBps)
+	bool mbps;
+	// lowest, unthrottled and step between values
+	size_t min, max, gran;
+	// the ids of the MBA domains
+	std::vector<size_t> domains;
+};
+
+static mba_range read_mba_range() {
+	mba_range res{false, false, 0, 0, 1, {}};
+	if (has_mba() == 0) return res;
+
+	// the root group is unthrottled
+	const auto root = resgroup_get_mba("");
+	if (root.empty()) return res;
+
+	res.available = true;
+	res.mbps = get_mba_uses_mbps() != 0;
+	for (const auto &d : root) {
+		res.max = std::max(res.max, d.second);
+		res.domains.push_back(d.first);
+	}
+	if (res.mbps) {
+		res.min = 1;
+	} else {
+		res.min = get_mba_min_bandwidth();
+		res.gran = std::max(1u, get_mba_bandwidth_gran());
 	}
+	return res;
 }
 
-[[noreturn]] static void restart_thread(fast::MQTT_communicator &comm) {
-	comm.add_subscription(baseTopic + "/restart");
+// rounds the MBA value for GByte/s to the granularity and limits it to the range
+static size_t to_mba_value(const mba_range &range, double value) {
+	const auto steps = static_cast<size_t>(std::max(0.0, std::round(value / range.gran)));
+	return std::min(range.max, std::max(range.min, steps * range.gran));
+}
+
+// value for every MBA domain
+static std::map<size_t, size_t> mba_values(const mba_range &range, size_t value) {
+	std::map<size_t, size_t> res;
+	for (const auto d : range.domains) res[d] = value;
+	return res;
+}
+
+// a resctrl group whose bandwidth is kept close to target
+struct throttled_group {
+	std::string cgroup;
+	double target;
+	// the MBA value of all domains
+	size_t value;
+	// true if the group was created for the request and is deleted when the cap is removed
+	bool created;
+	// the tasks of cgroup already in the group, as of the last sync_tasks()
+	std::set<pid_t> tasks;
+	// the last MBM reading, bytes is 0 before the first one
+	std::uint64_t bytes;
+	std::chrono::steady_clock::time_point time;
+	// GByte/s of the last interval, < 0 if unknown
+	double measured;
+};
+
+// moves the tasks of g.cgroup not yet seen into resgroup. Tasks that exited are
+// forgotten, so g.tasks does not grow and a reused tid is moved again.
+static void sync_tasks(const std::string &resgroup, throttled_group &g) {
+	if (g.cgroup.empty()) return;
+	std::set<pid_t> current;
+	for (auto tid : cgroup_get_tasks(g.cgroup)) {
+		current.insert(tid);
+		if (g.tasks.count(tid) != 0) continue;
+		try {
+			resgroup_add_task(resgroup, tid);
+		} catch (const std::exception &) {
+			// the thread exited in the meantime
+		}
+	}
+	g.tasks = std::move(current);
+}
+
+// updates g.measured with the MBM counters and moves g.value by the ratio of
+// target and measured bandwidth. Returns true if the value changed.
+static bool adjust_throttle(const mba_range &range, const std::string &resgroup, throttled_group &g) {
+	const auto now = std::chrono::steady_clock::now();
+	std::uint64_t bytes;
+	try {
+		bytes = resgroup_get_mbm_total_bytes(resgroup);
+	} catch (const std::exception &) {
+		// no MBM, the initial value stays
+		g.measured = -1.0;
+		return false;
+	}
+
+	const bool first = g.bytes == 0;
+	const std::chrono::duration<double> d = now - g.time;
+	const std::uint64_t delta = bytes - g.bytes;
+	g.bytes = bytes;
+	g.time = now;
+	if (first || d.count() <= 0.0) return false;
+	g.measured = gbyte_per_s(static_cast<double>(delta), d.count());
+
+	// within 5% of the target, or too little traffic to tell
+	if (std::abs(g.measured - g.target) <= 0.05 * g.target || g.measured < 0.01 * g.target) return false;
+
+	// MBA does not scale linearly, so move in bounded steps and converge over several intervals
+	const double ratio = std::min(2.0, std::max(0.5, g.target / g.measured));
+	const size_t old = g.value;
+	g.value = to_mba_value(range, static_cast<double>(g.value) * ratio);
+	// make progress even if the step is below the granularity
+	if (g.value == old && ratio > 1.0) g.value = std::min(range.max, old + range.gran);
+	if (g.value == old && ratio < 1.0) g.value = std::max(range.min, old > range.gran ? old - range.gran : 0);
+	if (g.value == old) return false;
+
+	resgroup_set_mba(resgroup, mba_values(range, g.value));
+	return true;
+}
+
+// handles throttle requests, which cap the memory bandwidth of a resctrl group
+// with MBA, and readjusts the caps every throttle_interval_ms
+[[noreturn]] static void throttle_thread(fast::Communicator &comm) {
+	const std::string topic = baseTopic + "/throttle";
+	const std::chrono::milliseconds interval(throttle_interval_ms);
+	comm.add_subscription(topic);
+
+	std::unique_ptr<mba_range> range;
+	std::map<std::string, throttled_group> groups;
+	auto next = std::chrono::steady_clock::now() + interval;
 	while (true) {
-		fast::msg::agent::mmbwmon::restart req;
-		auto m = comm.get_message(baseTopic + "/restart");
+		std::string m;
+		try {
+			const auto now = std::chrono::steady_clock::now();
+			m = comm.get_message(topic, next > now ? next - now : std::chrono::steady_clock::duration(0));
+		} catch (const std::exception &) {
+			// timeout, or not connected, which returns at once
+			std::this_thread::sleep_until(next);
+		}
+
+		if (std::chrono::steady_clock::now() >= next) {
+			for (auto it = groups.begin(); it != groups.end();) {
+				try {
+					sync_tasks(it->first, it->second);
+					if (adjust_throttle(*range, it->first, it->second))
+						std::cout << "Throttling " << it->first << " to " << it->second.value
+								  << (range->mbps ? " MByte/s" : "%") << ", measured " << it->second.measured
+								  << " GByte/s, cap " << it->second.target << " GByte/s\n";
+					++it;
+				} catch (const std::exception &e) {
+					std::cerr << "No longer throttling " << it->first << ": " << e.what() << std::endl;
+					it = groups.erase(it);
+				}
+			}
+			next = std::chrono::steady_clock::now() + interval;
+		}
+		if (m.empty()) continue;
 		std::cout << "Got message:\n" << m << "\n";
-		req.from_string(m);
 
-		cgroup_thaw(req.cgroup);
+		fast::msg::agent::mmbwmon::throttle req;
+		try {
+			req.from_string(m);
+		} catch (const std::exception &e) {
+			std::cerr << "Ignoring malformed request: " << e.what() << std::endl;
+			continue;
+		}
+		if (req.resgroup.empty() && req.cgroup.empty()) {
+			std::cerr << "Ignoring throttle request without cgroup and resgroup." << std::endl;
+			continue;
+		}
+		std::string resgroup = req.resgroup;
+		if (resgroup.empty()) {
+			resgroup = "mmbwmon_" + req.cgroup;
+			std::replace(resgroup.begin(), resgroup.end(), '/', '_');
+		}
+
+		if (!range) {
+			try {
+				range.reset(new mba_range(read_mba_range()));
+			} catch (const std::exception &e) {
+				std::cerr << "Could not read the MBA settings: " << e.what() << std::endl;
+				range.reset(new mba_range{false, false, 0, 0, 1, {}});
+			}
+			if (!range->available) std::cerr << "MBA is not available, throttle requests are not applied." << std::endl;
+		}
+
+		fast::msg::agent::mmbwmon::throttle_reply reply(resgroup, req.bandwidth, {}, range->mbps);
+		try {
+			if (!range->available) {
+				// the empty mba list tells the requester
+			} else if (req.bandwidth <= 0.0) {
+				const auto it = groups.find(resgroup);
+				if (it != groups.end()) {
+					reply.measured = it->second.measured;
+					if (it->second.created) {
+						// the tasks fall back to the root group
+						resgroup_delete(resgroup);
+						reply.mba = resgroup_get_mba("");
+					}
+					groups.erase(it);
+				}
+				if (reply.mba.empty()) {
+					resgroup_set_mba(resgroup, mba_values(*range, range->max));
+					reply.mba = resgroup_get_mba(resgroup);
+				}
+				std::cout << "Removed the bandwidth cap of " << resgroup << "\n";
+			} else {
+				auto it = groups.find(resgroup);
+				if (it == groups.end()) {
+					throttled_group g{req.cgroup, 0.0, 0, req.resgroup.empty(), {}, 0, {}, -1.0};
+					resgroup_create(resgroup);
+					it = groups.emplace(resgroup, std::move(g)).first;
+				}
+				auto &g = it->second;
+				g.target = req.bandwidth;
+				reply.measured = g.measured;
+
+				// the first guess is based on the calibrated peak, the next intervals correct it. mba_MBps
+				// limits every domain on its own, so the cap is split evenly between them. Its MByte/s are
+				// 1024^2 bytes, like the GByte/s of distgen are 1024^3 bytes.
+				double peak = 0.0;
+				for (const auto &n : node_peaks()) peak += n.second;
+				const double domains = static_cast<double>(std::max<size_t>(1, range->domains.size()));
+				g.value = to_mba_value(*range, range->mbps ? req.bandwidth * 1024.0 / domains
+														   : (peak > 0.0 ? 100.0 * req.bandwidth / peak : 100.0));
+				resgroup_set_mba(resgroup, mba_values(*range, g.value));
+				sync_tasks(resgroup, g);
+				reply.mba = resgroup_get_mba(resgroup);
+				std::cout << "Capped " << resgroup << " at " << req.bandwidth << " GByte/s, starting with "
+						  << g.value << (range->mbps ? " MByte/s" : "%") << "\n";
+			}
+		} catch (const std::exception &e) {
+			std::cerr << "Could not throttle " << resgroup << ": " << e.what() << std::endl;
+			const auto it = groups.find(resgroup);
+			if (it != groups.end()) {
+				if (it->second.created) {
+					try {
+						resgroup_delete(resgroup);
+					} catch (const std::exception &) {
+					}
+				}
+				groups.erase(it);
+			}
+			reply.mba.clear();
+		}
 
-		fast::msg::agent::mmbwmon::ack a;
-		comm.send_message(a.to_string(), baseTopic + "/restart/ack");
+		comm.send_message(reply.to_string(), topic + "/response");
 	}
 }
 #endif
 
+// restores the interference table in info if it was measured on a node of
+// the same size, returns the number of entries restored
+static size_t restore_interference(const fast::msg::agent::mmbwmon::system_info &info) {
+	const size_t node_cores = distgend_get_node_cores(*numa_nodes().begin());
+
+	std::vector<distgend_interferenceT> table;
+	for (int l = 0; l < DISTGEN_LOADS; ++l) {
+		const auto it = info.interference.find(load_names[l]);
+		if (it == info.interference.end()) continue;
+		for (const auto &v : it->second) {
+			if (v.size() != 5 || static_cast<size_t>(v[0]) != node_cores) return 0;
+			table.push_back(distgend_interferenceT{node_cores, static_cast<size_t>(v[1]), static_cast<size_t>(v[2]),
+												   static_cast<distgend_loadT>(l), v[3], v[4]});
+		}
+	}
+
+	distgend_set_interference(table.data(), table.size());
+	return table.size();
+}
+
+// restores the idle latency of the nodes in info that exist on this system
+static void restore_idle_latency(const fast::msg::agent::mmbwmon::system_info &info) {
+	const std::set<size_t> nodes = numa_nodes();
+	for (const auto &node : info.idle_latency) {
+		if (nodes.count(node.first) == 0) continue;
+		const auto get = [&node](const char *name) {
+			const auto it = node.second.find(name);
+			return (it == node.second.end()) ? 0.0 : it->second;
+		};
+		const size_t samples = static_cast<size_t>(get("samples"));
+		if (samples == 0) continue;
+		distgend_set_idle_latency(node.first, distgend_latencyT{get("min"), get("p50"), get("p90"), get("p99"),
+																get("p999"), get("max"), get("mean"), samples});
+	}
+}
+
+// restores the points of the curves in info that are valid for this system,
+// returns the number of points restored
+static size_t restore_curves(const fast::msg::agent::mmbwmon::system_info &info) {
+	size_t res = 0;
+	for (const auto &node : info.curves) {
+		const size_t cores = distgend_get_node_cores(node.first);
+		for (int c = 0; c < DISTGEN_CURVES; ++c) {
+			const auto it = node.second.find(curve_names[c]);
+			// the node changed, e.g. CPUs have been taken offline
+			if (it == node.second.end() || it->second.size() != cores) continue;
+
+			for (size_t k = 0; k < cores; ++k) {
+				if (it->second[k] <= 0.0) continue;
+				distgend_set_curve(node.first, static_cast<distgend_curveT>(c), k + 1, it->second[k]);
+				stored_info.curves[node.first][curve_names[c]][k] = it->second[k];
+				++res;
+			}
+		}
+	}
+	return res;
+}
+
 static void init_mmbwmon() {
+	distgend_init_uncalibrated(distgen_init);
+
+	const distgend_placementT placement = distgend_get_placement();
+	stored_info = fast::msg::agent::mmbwmon::system_info(distgen_init.number_of_threads, distgen_init.SMT_factor,
+														 distgen_init.NUMA_domains, std::vector<double>(),
+														 placement.page_size, placement.local_fraction,
+														 distgend_get_buffer_size());
+	size_t points = 0;
+	for (size_t node : numa_nodes()) {
+		for (const char *name : curve_names) stored_info.curves[node][name].assign(distgend_get_node_cores(node), 0.0);
+		points += DISTGEN_CURVES * distgend_get_node_cores(node);
+	}
+
 	std::ifstream info_file;
 	std::string info_filename(home_dir + "/" + get_hostname() + ".info");
 	info_file.open(info_filename, std::ifstream::in);
 
+	size_t restored = 0, restored_interference = 0;
 	if (!measure_only && home_dir_available && info_file.is_open()) {
 		std::istreambuf_iterator<char> iter(info_file);
 		std::string str(iter, std::istreambuf_iterator<char>());
@@ -268,83 +1138,94 @@ static void init_mmbwmon() {
 		fast::msg::agent::mmbwmon::system_info info;
 		info.from_string(str);
 
-		if (info.threads == distgen_init.number_of_threads && info.smt == distgen_init.SMT_factor &&
-			info.numa == distgen_init.NUMA_domains) {
-			std::cout << "Read previous config from file " << info_filename << std::endl;
-			distgend_init_without_bench(distgen_init, &info.membw[0]);
-			return;
+		// results measured with a different buffer size or placement are not comparable
+		if (info_matches(info, distgen_init, distgend_get_buffer_size(), placement)) {
+			if (!info.curves.empty()) {
+				restored = restore_curves(info);
+				restored_interference = restore_interference(info);
+				restore_idle_latency(info);
+			} else if (restore_legacy_info(info, distgen_init)) {
+				std::cout << "Read previous config from file " << info_filename << std::endl;
+				return;
+			}
 		}
 
-		std::cout << "Previously results were measured with different settings. Starting measurement again."
-				  << std::endl;
+		if (restored == points) {
+			std::cout << "Read previous config from file " << info_filename << std::endl;
+		} else if (restored > 0) {
+			std::cout << "Read " << restored << " of " << points << " calibration points from file " << info_filename
+					  << std::endl;
+		} else {
+			std::cout << "Previously results were measured with different settings. Starting measurement again."
+					  << std::endl;
+		}
 	}
 
-	std::cout << "Starting distgen initialization ...";
-	std::cout.flush();
-	distgend_init(distgen_init);
-
-	std::cout << " done!\n\n";
-}
-
-static int perf_event_open(struct perf_event_attr *hw_event, pid_t pid, size_t cpu, int group_fd, unsigned long flags) {
-	return static_cast<int>(syscall(__NR_perf_event_open, hw_event, pid, static_cast<int>(cpu), group_fd, flags));
+	if (restored < points) {
+		std::cout << "Starting distgen initialization ...";
+		std::cout.flush();
+	}
+	distgend_calibrate(probe.tolerance > 0.0 ? &probe : nullptr, checkpoint, nullptr);
+	if (restored < points) std::cout << " done!\n\n";
+
+	if (measure_interference && restored_interference == 0) {
+		std::cout << "Measuring the interference between loads ...";
+		std::cout.flush();
+		distgend_calibrate_interference(probe.tolerance > 0.0 ? &probe : nullptr);
+		std::cout << " done!\n\n";
+	}
 }
 
-static std::vector<int> init_perf() {
-
-	std::vector<int> fds;
-	fds.reserve(distgen_init.number_of_threads);
-
-	perf_event_attr event;
-	memset(&event, 0, sizeof(perf_event_attr));
-
-	event.type = PERF_TYPE_HARDWARE;
-	event.size = sizeof(struct perf_event_attr);
-	event.config = PERF_COUNT_HW_INSTRUCTIONS;
-	event.disabled = 1;
-	event.exclude_kernel = 1;
-	event.exclude_hv = 1;
-
-	// for each CPU:
-	// create a systemwide monitor restricted to a set of CPUs
-	for (size_t i = 0; i < distgen_init.number_of_threads; ++i) {
-		auto fd = perf_event_open(&event, -1, i, -1, 0);
-		if (fd == -1) {
-			std::cerr << "Could not create perf event for core " << i
-					  << ". Please set /proc/sys/kernel/perf_event_paranoid to -1." << std::endl;
-			return std::vector<int>();
+// measures one core and all cores of every NUMA node with buffers from 1/4 to
+// 16 times the size of the last level cache
+static void run_sweep() {
+	// the sweep does not need the calibration results
+	const std::vector<double> membw(distgen_init.number_of_threads, 0.0);
+	distgend_init_without_bench(distgen_init, membw.data());
+
+	size_t llc = 0, llc_threads = 0;
+	for (size_t t = 0; t < distgen_init.number_of_threads; ++t) {
+		const distgend_cpuT cpu = distgend_get_cpu(t);
+		if (cpu.llc_size > llc) {
+			llc = cpu.llc_size;
+			llc_threads = cpu.llc_threads;
 		}
-		fds.push_back(fd);
+	}
+	if (llc != 0) {
+		std::cout << "last level cache: " << llc / 1024 / 1024 << " MiB shared by " << llc_threads << " threads"
+				  << std::endl;
+	} else {
+		std::cout << "last level cache: unknown" << std::endl;
 	}
 
-	return fds;
-}
+	std::vector<size_t> sizes;
+	const size_t base = (llc != 0) ? llc : distgend_get_buffer_size();
+	for (size_t factor = 1; factor <= 64; factor *= 2) sizes.push_back(base / 4 * factor);
 
-static void start_perf_measurement(const std::vector<int> &fds) {
-	for (auto fd : fds) {
-		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
-		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	std::map<size_t, std::vector<size_t>> node_cores;
+	for (size_t i = 0; i < distgend_get_core_count(); ++i) {
+		const size_t t = distgend_get_compact_thread(i);
+		node_cores[distgend_get_cpu(t).node].push_back(t);
 	}
-}
 
-static void stop_perf_measurement(const std::vector<int> &fds) {
-	for (auto fd : fds) {
-		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
-	}
-}
+	distgend_probeT sweep_probe = probe;
+	if (sweep_probe.tolerance <= 0.0) sweep_probe.tolerance = 0.02;
+
+	std::cout << "node\tcores\tsize (MiB)\tGByte/s\t\t+-" << std::endl;
+	for (const auto &node : node_cores) {
+		std::vector<size_t> counts{1};
+		if (node.second.size() > 1) counts.push_back(node.second.size());
 
-static std::vector<long long> read_perf_measurement(const std::vector<int> &fds) {
-	std::vector<long long> counts;
-	for (size_t i = 0; i < fds.size(); ++i) {
-		auto fd = fds[i];
-		long long count;
-		auto temp = read(fd, &count, sizeof(long long));
-		if (temp == -1) {
-			std::cerr << "Could not read from perf event for core " << i << std::endl;
+		for (const size_t count : counts) {
+			std::vector<distgend_estimateT> results(sizes.size());
+			distgend_sweep_set({count, node.second.data()}, sweep_probe, sizes.data(), sizes.size(), results.data());
+
+			for (size_t i = 0; i < sizes.size(); ++i) {
+				std::cout << node.first << "\t" << count << "\t" << sizes[i] / 1024 / 1024 << "\t\t"
+						  << results[i].value << "\t\t" << 1.96 * std::sqrt(results[i].variance) << std::endl;
+			}
 		}
-		counts.push_back(count);
 	}
-	return counts;
 }
 
 int main(int argc, char const *argv[]) {
@@ -359,34 +1240,116 @@ int main(int argc, char const *argv[]) {
 	}
 
 	parse_options(static_cast<size_t>(argc), argv);
+	distgend_set_buffer_idle_time(buffer_idle_s);
+
+	if (sweep) {
+		run_sweep();
+		return 0;
+	}
 
-	auto perf_ids = init_perf();
-	start_perf_measurement(perf_ids);
+	std::vector<size_t> cpus;
+	for (size_t i = 0; i < distgen_init.number_of_threads; ++i) cpus.push_back(i);
+	std::unique_ptr<perf_counters> instructions;
+	try {
+		instructions.reset(new perf_counters({"instructions:u"}, cpus));
+		instructions->start();
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << ". Please set /proc/sys/kernel/perf_event_paranoid to -1." << std::endl;
+	}
 	init_mmbwmon();
-	stop_perf_measurement(perf_ids);
-	auto perf_results = read_perf_measurement(perf_ids);
-	for (size_t i = 0; i < perf_results.size(); ++i) {
-		std::cout << "Core " << i << " issued " << perf_results[i] << " instructions." << std::endl;
+	if (instructions) {
+		instructions->stop();
+		const auto counts = instructions->read();
+		for (size_t i = 0; i < counts.size(); ++i) {
+			std::cout << "Core " << instructions->cpus()[i] << " issued " << counts[i][0] << " instructions."
+					  << std::endl;
+		}
+	}
+
+	if (prewarm) {
+		std::vector<size_t> cores;
+		for (size_t i = 0; i < distgend_get_core_count(); ++i) cores.push_back(distgend_get_compact_thread(i));
+		distgend_prewarm_set({cores.size(), cores.data()});
 	}
 
 	print_distgen_results(distgen_init);
-	write_gnuplot_file(distgen_init);
-	write_yaml_file(distgen_init);
+	write_gnuplot_file();
+	write_yaml_file();
 
 	if (measure_only) return 0;
 
-	fast::MQTT_communicator comm(agentID, baseTopic + "/request", baseTopic + "/response", server,
-								 static_cast<int>(port), 60);
+	if (snapshot_path != "none") {
+		try {
+			snapshot.reset(new snapshot_writer(snapshot_path));
+			std::vector<double> membw;
+			for (size_t i = 0; i < distgend_get_core_count(); ++i)
+				membw.push_back(distgend_get_measured_idle_bandwidth(i + 1));
+			snapshot->set_calibration(membw, node_peaks());
+			std::cout << "Publishing results in " << snapshot_path << std::endl;
+		} catch (const std::exception &e) {
+			std::cerr << "Not publishing results: " << e.what() << std::endl;
+		}
+	}
+
+	if (passive_interval_ms > 0) {
+		std::map<size_t, size_t> cpu_to_node;
+		for (size_t t = 0; t < distgen_init.number_of_threads; ++t) {
+			const auto cpu = distgend_get_cpu(t);
+			cpu_to_node[cpu.cpu] = cpu.node;
+		}
+
+		try {
+			monitor.reset(new passive_monitor(make_bandwidth_source(passive_source, cpu_to_node),
+											  std::chrono::milliseconds(passive_interval_ms), passive_history));
+			std::cout << "Passive mode, reading " << monitor->source_name() << " counters every "
+					  << passive_interval_ms << " ms." << std::endl;
+			// a source failing on every read never delivers a sample
+			monitor->wait_for_sample(std::chrono::milliseconds(5 * passive_interval_ms + 1000));
+		} catch (const std::exception &e) {
+			std::cerr << "Could not start passive mode: " << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	if (record_path != "") {
+		trace_header header{coalesce_window_ms, cache_ttl_ms, {}};
+		for (size_t t = 0; t < distgen_init.number_of_threads; ++t)
+			header.nodes.push_back(static_cast<std::uint32_t>(distgend_get_cpu(t).node));
+		try {
+			recorder.reset(new trace_writer(record_path, header));
+			std::cout << "Recording requests in " << record_path << std::endl;
+		} catch (const std::exception &e) {
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	std::unique_ptr<fast::Communicator> comm;
+	if (local_socket != "") {
+		comm.reset(new fast::Local_communicator(local_socket, fast::Local_communicator::role::server,
+												baseTopic + "/request", baseTopic + "/response"));
+		std::cout << "Serving node-local clients on " << local_socket << std::endl;
+	} else {
+		comm.reset(new fast::MQTT_communicator(agentID, baseTopic + "/request", baseTopic + "/response", server,
+											   static_cast<int>(port), 60));
+	}
 
-	std::thread bench(bench_thread, std::ref(comm));
+	std::thread bench(bench_thread, std::ref(*comm));
+	std::thread latency(latency_thread, std::ref(*comm));
+	std::thread buffers;
+	if (buffer_idle_s >= 0.0) buffers = std::thread(buffer_thread);
 #ifdef CGROUP_SUPPORT
-	std::thread restart(restart_thread, std::ref(comm));
-	std::thread stop(stop_thread, std::ref(comm));
+	std::thread restart(restart_thread, std::ref(*comm));
+	std::thread stop(stop_thread, std::ref(*comm));
+	std::thread throttle(throttle_thread, std::ref(*comm));
 #endif
 
 	bench.join();
+	latency.join();
+	if (buffers.joinable()) buffers.join();
 #ifdef CGROUP_SUPPORT
 	restart.join();
 	stop.join();
+	throttle.join();
 #endif
 }
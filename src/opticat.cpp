@@ -1,68 +1,136 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <numeric>
+#include <set>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include <cassert>
-#include <cstring>
 
-// for perf support
-#include <linux/perf_event.h>
-#include <sys/ioctl.h>
-#include <syscall.h>
+#include <sys/stat.h>
+
 #include <unistd.h>
 
 #include <distgen/distgen.h>
 #include <ponci/ponci.hpp>
 #include <ponri/ponri.hpp>
 
+#include "partition_search.hpp"
+#include "perf_counters.hpp"
+
 /*** constants **/
 const std::string res_name("opticat");
 const std::chrono::seconds measurement_time(10);
+// a measurement ends early once the rates of the last stable_samples intervals
+// deviate less than stable_deviation from their mean
+const std::chrono::milliseconds sample_interval(1000);
+const size_t stable_samples = 3;
+const double stable_deviation = 0.02;
 
 /*** config vars **/
 static distgend_initT distgen_init;
 static std::string command;
 static bool use_cache_clear = false;
 static bool brute_force = false;
+static double search_tolerance = 0.0;
+static std::chrono::seconds warmup_time(measurement_time * 9);
+static std::string schemata_dir("opticat-partition");
 
-static std::vector<std::thread> thread_pool;
+// an application sharing the cache in partition mode
+struct application {
+	std::string name; // of its cgroup and resctrl group
+	std::vector<size_t> cpus;
+	double weight;
+	std::string command;
+};
+static std::vector<application> applications;
+
+/*** results **/
+struct sample {
+	std::bitset<64> mask;
+	// per second, averaged over the last stable_samples intervals
+	double llc_misses;
+	double instructions;
+	// duration of the measurement
+	double seconds;
+};
 
-static void setup_cat() {
-	resgroup_create(res_name);
-	cgroup_create(res_name);
+static std::vector<std::thread> thread_pool;
+// the cgroups and resctrl groups created
+static std::vector<std::string> groups;
+
+// parses a kernel CPU list, e.g. "0-3,8"
+static std::vector<size_t> parse_cpulist(const std::string &list) {
+	std::vector<size_t> res;
+	std::stringstream ranges(list);
+	std::string range;
+	while (std::getline(ranges, range, ',')) {
+		const auto dash = range.find('-');
+		const size_t from = std::stoul(range.substr(0, dash));
+		const size_t to = (dash == std::string::npos) ? from : std::stoul(range.substr(dash + 1));
+		for (size_t cpu = from; cpu <= to; ++cpu) res.push_back(cpu);
+	}
+	return res;
+}
 
-	// use all selected threads for this group
+// the OS ids of the online CPUs
+static std::vector<size_t> all_cpus() {
 	// TODO change to number of threads per NUMA domain
-	std::vector<size_t> cpus;
-	for (size_t i = 0; i < distgen_init.number_of_threads; ++i) {
-		cpus.push_back(i);
-	}
+	std::ifstream online(perf_sysfs_root() + "/devices/system/cpu/online");
+	std::string list;
+	std::getline(online, list);
+	return parse_cpulist(list);
+}
 
-	resgroup_set_cpus(res_name, cpus);
-	cgroup_set_cpus(res_name, cpus);
+static void setup_group(const std::string &name, const std::vector<size_t> &cpus) {
+	resgroup_create(name);
+	cgroup_create(name);
+	groups.push_back(name);
 
-	size_t mems[] = {0, 1};
-	cgroup_set_mems(res_name, mems, 2);
+	resgroup_set_cpus(name, cpus);
+	cgroup_set_cpus(name, cpus);
+
+	std::vector<size_t> mems;
+	for (size_t i = 0; i < distgen_init.NUMA_domains; ++i) {
+		mems.push_back(i);
+	}
+	cgroup_set_mems(name, mems);
 }
 
+// use all selected threads for this group
+static void setup_cat() { setup_group(res_name, all_cpus()); }
+
 [[noreturn]] static void cleanup() {
-	cgroup_kill(res_name);
-	resgroup_delete(res_name);
-	thread_pool[0].join();
+	for (const auto &name : groups) {
+		cgroup_kill(name);
+		resgroup_delete(name);
+	}
+	for (auto &t : thread_pool) t.join();
 	exit(0);
 }
 
 [[noreturn]] static void print_help(const char *argv) {
 	std::cout << argv << " supports the following flags:\n";
-	std::cout << "\t --numa \t Number of NUMA domains. \t\t\t Default: 2\n";
-	std::cout << "\t --threads \t Number of logical cores. \t\t\t Default: " << std::thread::hardware_concurrency()
-			  << "\n";
-	std::cout << "\t --smt \t\t Number of logical cores per physical core. \t Default: 2\n";
+	std::cout << "\t --numa \t Number of NUMA domains. \t\t\t Default: detected\n";
+	std::cout << "\t --threads \t Number of logical cores. \t\t\t Default: detected\n";
+	std::cout << "\t --smt \t\t Number of logical cores per physical core. \t Default: detected\n";
 	std::cout << "\t --cache-clear \t Use cache clear. \t Default: disabled\n";
 	std::cout << "\t --brute-force \t Brute force all combinations. \t Default: disabled\n";
+	std::cout << "\t --search \t Bisect for the smallest mask within <fraction> of the full cache performance. "
+				 "Default: disabled\n";
+	std::cout << "\t --warmup \t Seconds the command runs before the first measurement. \t Default: 90\n";
+	std::cout << "\t --app <cpus> <weight> <command> Partition the cache between several commands, each running on "
+				 "its CPU list (e.g. 0-3,8). Repeat for every command. \t No default\n";
+	std::cout << "\t --schemata \t Directory the schemata of the partition are written to. \t Default: "
+				 "opticat-partition\n";
 	std::cout << "\t -- <command> \t The command to be executed. \t No default\n";
 	exit(0);
 }
@@ -72,9 +140,13 @@ static void parse_options(size_t argc, const char **argv) {
 		print_help(argv[0]);
 	}
 
-	distgen_init.number_of_threads = std::thread::hardware_concurrency();
-	distgen_init.NUMA_domains = 2;
-	distgen_init.SMT_factor = 2;
+	// the flags below overwrite the detected topology
+	if (distgend_detect_topology(&distgen_init) != 0) {
+		std::cerr << "Could not detect the CPU topology, assuming 2 NUMA domains and SMT 2." << std::endl;
+		distgen_init.number_of_threads = std::thread::hardware_concurrency();
+		distgen_init.NUMA_domains = 2;
+		distgen_init.SMT_factor = 2;
+	}
 
 	for (size_t i = 1; i < argc; ++i) {
 		std::string arg(argv[i]);
@@ -109,12 +181,46 @@ static void parse_options(size_t argc, const char **argv) {
 		}
 		if (arg == "--cache-clear") {
 			use_cache_clear = true;
-			++i;
 			continue;
 		}
 		if (arg == "--brute-force") {
 			brute_force = true;
 			use_cache_clear = true;
+			continue;
+		}
+		if (arg == "--app") {
+			if (i + 3 >= argc) {
+				print_help(argv[0]);
+			}
+			application a{res_name + "_" + std::to_string(applications.size()), parse_cpulist(argv[i + 1]),
+						  std::stod(std::string(argv[i + 2])), std::string(argv[i + 3])};
+			if (a.cpus.empty() || a.weight <= 0.0) print_help(argv[0]);
+			applications.push_back(std::move(a));
+			i += 3;
+			continue;
+		}
+		if (arg == "--schemata") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			schemata_dir = std::string(argv[i + 1]);
+			++i;
+			continue;
+		}
+		if (arg == "--search") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			search_tolerance = std::stod(std::string(argv[i + 1]));
+			if (search_tolerance <= 0.0) print_help(argv[0]);
+			++i;
+			continue;
+		}
+		if (arg == "--warmup") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			warmup_time = std::chrono::seconds(std::stoul(std::string(argv[i + 1])));
 			++i;
 			continue;
 		}
@@ -131,103 +237,57 @@ static void parse_options(size_t argc, const char **argv) {
 		}
 	}
 
-	print_help(argv[0]);
-}
+	if (applications.empty()) print_help(argv[0]);
 
-static int perf_event_open(struct perf_event_attr *hw_event, pid_t pid, size_t cpu, int group_fd, unsigned long flags) {
-	return static_cast<int>(syscall(__NR_perf_event_open, hw_event, pid, static_cast<int>(cpu), group_fd, flags));
-}
-
-// open event per core for every core
-static std::vector<int> init_perf() {
-
-	std::vector<int> fds;
-	fds.reserve(distgen_init.number_of_threads);
-
-	perf_event_attr event;
-	memset(&event, 0, sizeof(perf_event_attr));
-
-	event.type = PERF_TYPE_HARDWARE;
-	event.size = sizeof(struct perf_event_attr);
-	event.config = PERF_COUNT_HW_CACHE_MISSES;
-	event.disabled = 1;
-	event.exclude_kernel = 1;
-	event.exclude_hv = 1;
-
-	// for each CPU:
-	// create a systemwide monitor restricted to a set of CPUs to monitor cache misses
-	for (size_t i = 0; i < distgen_init.number_of_threads; ++i) {
-		auto fd = perf_event_open(&event, -1, i, -1, 0);
-		if (fd == -1) {
-			std::cerr << "Could not create perf event for core " << i
-					  << ". Please set /proc/sys/kernel/perf_event_paranoid to -1." << std::endl;
-			return std::vector<int>();
-		}
-		fds.push_back(fd);
-	}
-
-	event.config = PERF_COUNT_HW_INSTRUCTIONS;
-	for (size_t i = 0; i < distgen_init.number_of_threads; ++i) {
-		auto fd = perf_event_open(&event, -1, i, -1, 0);
-		if (fd == -1) {
-			std::cerr << "Could not create perf event for core " << i
-					  << ". Please set /proc/sys/kernel/perf_event_paranoid to -1." << std::endl;
-			return std::vector<int>();
+	// the CPU lists are OS ids
+	const std::vector<size_t> online = all_cpus();
+	std::set<size_t> unused(online.begin(), online.end());
+	for (const auto &a : applications) {
+		for (auto cpu : a.cpus) {
+			if (unused.erase(cpu) == 0) {
+				std::cerr << "CPU " << cpu << " of " << a.command << " is not online or is used twice." << std::endl;
+				exit(1);
+			}
 		}
-		fds.push_back(fd);
-	}
-
-	return fds;
-}
-
-static void start_perf_measurement(const std::vector<int> &fds) {
-	for (auto fd : fds) {
-		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
-		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
-	}
-}
-
-static void stop_perf_measurement(const std::vector<int> &fds) {
-	for (auto fd : fds) {
-		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
 	}
 }
 
-static std::vector<long long> read_perf_measurement(const std::vector<int> &fds) {
-	std::vector<long long> counts;
-	for (size_t i = 0; i < fds.size(); ++i) {
-		auto fd = fds[i];
-		long long count;
-		auto temp = read(fd, &count, sizeof(long long));
-		if (temp == -1) {
-			std::cerr << "Could not read from perf event for core " << i << std::endl;
-		}
-		counts.push_back(count);
+// counts LLC misses (event 0) and instructions (event 1) on every CPU
+static std::unique_ptr<perf_counters> init_perf() {
+	try {
+		return std::unique_ptr<perf_counters>(new perf_counters({"cache-misses:u", "instructions:u"}, all_cpus()));
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << ". Please set /proc/sys/kernel/perf_event_paranoid to -1." << std::endl;
+		return nullptr;
 	}
-	return counts;
 }
 
-static void execute_command_internal(std::string command) {
-	cgroup_add_me(res_name);
+static void execute_command_internal(std::string group, std::string command, std::string log) {
+	cgroup_add_me(group);
 	// command += "| tee ";
 	command += "> ";
-	command += "cmd.log";
+	command += log;
 	command += " 2>&1 ";
 
 	auto temp = system(command.c_str());
 	assert(temp != -1);
 }
 
-static void execute_command(std::string command) { thread_pool.emplace_back(&execute_command_internal, command); }
+static void execute_command(const std::string &group, const std::string &command, const std::string &log) {
+	thread_pool.emplace_back(&execute_command_internal, group, command, log);
+}
 
-static std::bitset<64> create_minimal_bitset() {
+// the mask of the lowest @p ways ways
+static std::bitset<64> create_bitset(size_t ways) {
 	std::bitset<64> bits;
-	for (size_t i = 0; i < get_min_cbm_bits(); ++i) {
+	for (size_t i = 0; i < ways; ++i) {
 		bits.set(i);
 	}
 	return bits;
 }
 
+static std::bitset<64> create_minimal_bitset() { return create_bitset(get_min_cbm_bits()); }
+
 static std::bitset<64> increase_bitset(std::bitset<64> bits) {
 	for (size_t i = 0; i < bits.size(); ++i) {
 		if (!bits[i]) {
@@ -240,14 +300,13 @@ static std::bitset<64> increase_bitset(std::bitset<64> bits) {
 
 // run distgen to evict everything from the cache
 static void clear_cache() {
-	cgroup_freeze(res_name);
+	for (const auto &name : groups) cgroup_freeze(name);
 
-	distgend_configT dg;
-	dg.number_of_threads = distgen_init.number_of_threads;
-	for (unsigned char i = 0; i < distgen_init.number_of_threads; ++i) dg.threads_to_use[i] = i;
-	distgend_is_membound(dg);
+	std::vector<size_t> threads;
+	for (size_t i = 0; i < distgen_init.number_of_threads; ++i) threads.push_back(i);
+	distgend_is_membound_set({threads.size(), threads.data()});
 
-	cgroup_thaw(res_name);
+	for (const auto &name : groups) cgroup_thaw(name);
 }
 
 static std::bitset<64> general_all_bitmasks() {
@@ -265,10 +324,236 @@ static std::bitset<64> general_all_bitmasks() {
 	return std::bitset<64>(0);
 }
 
+// true if the rates of the last stable_samples intervals are within stable_deviation of their mean
+static bool is_stable(const std::vector<std::pair<double, double>> &rates) {
+	if (rates.size() < stable_samples) return false;
+
+	const auto begin = rates.end() - static_cast<long>(stable_samples);
+	const auto stable = [&](double std::pair<double, double>::*rate) {
+		double mean = 0.0;
+		for (auto it = begin; it != rates.end(); ++it) mean += (*it).*rate;
+		mean /= stable_samples;
+		for (auto it = begin; it != rates.end(); ++it)
+			if (std::abs((*it).*rate - mean) > stable_deviation * mean) return false;
+		return true;
+	};
+	return stable(&std::pair<double, double>::first) && stable(&std::pair<double, double>::second);
+}
+
+// measures the LLC misses and instructions per second of every set of CPUs
+// every sample_interval until the rates of all sets are stable, but at most
+// for measurement_time. Returns (llc misses, instructions) of every set and
+// stores the duration in @p seconds.
+static std::vector<std::pair<double, double>> measure_rates(perf_counters &counters,
+															const std::vector<std::vector<size_t>> &cpu_sets,
+															double &seconds) {
+	// read() is indexed by the position of the OS CPU id in counters.cpus()
+	std::map<size_t, size_t> index;
+	for (size_t i = 0; i < counters.cpus().size(); ++i) index[counters.cpus()[i]] = i;
+
+	// (llc misses, instructions) per interval of every set
+	std::vector<std::vector<std::pair<double, double>>> rates(cpu_sets.size());
+	std::vector<std::pair<double, double>> last_counts(cpu_sets.size(), std::make_pair(0.0, 0.0));
+
+	const auto start = std::chrono::steady_clock::now();
+	auto last = start;
+	bool stable;
+	counters.start();
+	do {
+		std::this_thread::sleep_until(last + sample_interval);
+		const auto res = counters.read();
+		const auto now = std::chrono::steady_clock::now();
+		const std::chrono::duration<double> d = now - last;
+
+		stable = true;
+		for (size_t s = 0; s < cpu_sets.size(); ++s) {
+			std::pair<double, double> counts(0.0, 0.0);
+			for (auto cpu : cpu_sets[s]) {
+				counts.first += res[index.at(cpu)][0];
+				counts.second += res[index.at(cpu)][1];
+			}
+			rates[s].emplace_back((counts.first - last_counts[s].first) / d.count(),
+								  (counts.second - last_counts[s].second) / d.count());
+			last_counts[s] = counts;
+			stable &= is_stable(rates[s]);
+		}
+		last = now;
+	} while (last - start < measurement_time && !stable);
+	counters.stop();
+
+	seconds = std::chrono::duration<double>(last - start).count();
+	std::vector<std::pair<double, double>> res;
+	for (const auto &r : rates) {
+		const size_t n = std::min(stable_samples, r.size());
+		std::pair<double, double> mean(0.0, 0.0);
+		for (size_t i = r.size() - n; i < r.size(); ++i) {
+			mean.first += r[i].first / static_cast<double>(n);
+			mean.second += r[i].second / static_cast<double>(n);
+		}
+		res.push_back(mean);
+	}
+	return res;
+}
+
+// applies @p mask and measures all CPUs, see measure_rates(). Throws if the mask is invalid.
+static sample measure(perf_counters &counters, std::bitset<64> mask) {
+	const std::vector<size_t> schematas(distgen_init.NUMA_domains, mask.to_ullong());
+	resgroup_set_schemata(res_name, schematas);
+
+	if (use_cache_clear) {
+		clear_cache();
+	}
+
+	double seconds;
+	const auto rates = measure_rates(counters, {all_cpus()}, seconds);
+	return sample{mask, rates[0].first, rates[0].second, seconds};
+}
+
+static void print_samples(const std::vector<sample> &samples, const sample &reference) {
+	std::cout << "mask \t\t llc/s \t\t llc(nom) \t\t instr/s \t\t instr(nom) \t seconds" << std::endl;
+	for (const auto &s : samples) {
+		std::cout << std::hex << s.mask.to_ullong() << " \t\t " << std::dec << s.llc_misses << " \t "
+				  << s.llc_misses / reference.llc_misses << " \t " << s.instructions << " \t "
+				  << s.instructions / reference.instructions << " \t " << s.seconds << std::endl;
+	}
+}
+
+// Bisects the number of ways for the smallest mask whose instruction rate is at
+// most search_tolerance below and whose LLC miss rate is at most
+// search_tolerance above the full cache, assuming both improve with more ways.
+static sample search_knee(perf_counters &counters) {
+	std::map<size_t, sample> samples;
+	const auto measure_ways = [&](size_t ways) -> const sample & {
+		auto it = samples.find(ways);
+		if (it == samples.end()) {
+			it = samples.emplace(ways, measure(counters, create_bitset(ways))).first;
+			std::cout << "." << std::flush;
+		}
+		return it->second;
+	};
+
+	const sample full = measure_ways(get_cbm_mask().count());
+	const auto within_tolerance = [&](const sample &s) {
+		return s.instructions >= (1.0 - search_tolerance) * full.instructions &&
+			   s.llc_misses <= (1.0 + search_tolerance) * full.llc_misses;
+	};
+
+	size_t low = get_min_cbm_bits();
+	size_t high = get_cbm_mask().count();
+	while (low < high) {
+		const size_t mid = low + (high - low) / 2;
+		if (within_tolerance(measure_ways(mid)))
+			high = mid;
+		else
+			low = mid + 1;
+	}
+
+	std::cout << " measurement done!" << std::endl << std::endl;
+	std::vector<sample> measured;
+	for (const auto &s : samples) measured.push_back(s.second);
+	print_samples(measured, full);
+
+	return samples.at(high);
+}
+
+// the masks of an allocation, consecutive blocks of ways starting at the lowest way
+static std::vector<std::bitset<64>> partition_masks(const partition_search::ways_t &ways) {
+	std::vector<std::bitset<64>> res;
+	size_t offset = 0;
+	for (auto w : ways) {
+		res.push_back(create_bitset(w) << offset);
+		offset += w;
+	}
+	return res;
+}
+
+static std::string schemata_line(std::bitset<64> mask) {
+	std::stringstream stream;
+	stream << "L3:";
+	for (size_t n = 0; n < distgen_init.NUMA_domains; ++n)
+		stream << (n == 0 ? "" : ";") << n << "=" << std::hex << mask.to_ullong() << std::dec;
+	return stream.str();
+}
+
+// writes <schemata_dir>/<group>/schemata for every application
+static void write_schemata(const std::vector<std::bitset<64>> &masks) {
+	mkdir(schemata_dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+	for (size_t a = 0; a < applications.size(); ++a) {
+		const std::string dir = schemata_dir + "/" + applications[a].name;
+		mkdir(dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+		std::ofstream file(dir + "/schemata");
+		file << schemata_line(masks[a]) << std::endl;
+		if (!file) std::cerr << "Could not write " << dir << "/schemata" << std::endl;
+	}
+}
+
+// finds the partition of the cache with the highest weighted throughput of all applications
+static void partition(perf_counters &counters) {
+	const double tolerance = search_tolerance > 0.0 ? search_tolerance : 0.05;
+	std::vector<std::vector<size_t>> cpu_sets;
+	std::vector<double> weights;
+	for (const auto &a : applications) {
+		cpu_sets.push_back(a.cpus);
+		weights.push_back(a.weight);
+	}
+
+	// (llc misses, instructions) of the last measurement of every allocation
+	std::map<partition_search::ways_t, std::vector<std::pair<double, double>>> results;
+	const auto measure_allocation = [&](const partition_search::ways_t &ways) {
+		const auto masks = partition_masks(ways);
+		for (size_t a = 0; a < applications.size(); ++a) {
+			const std::vector<size_t> schematas(distgen_init.NUMA_domains, masks[a].to_ullong());
+			resgroup_set_schemata(applications[a].name, schematas);
+		}
+		if (use_cache_clear) {
+			clear_cache();
+		}
+
+		double seconds;
+		auto &rates = results[ways];
+		rates = measure_rates(counters, cpu_sets, seconds);
+		std::cout << "." << std::flush;
+
+		std::vector<double> instructions;
+		for (const auto &r : rates) instructions.push_back(r.second);
+		return instructions;
+	};
+
+	partition_search search(measure_allocation, weights, get_cbm_mask().count(), get_min_cbm_bits(), tolerance);
+	const auto best = search.run();
+	const auto equal = search.equal_split();
+	const auto equal_rates = results.at(equal);
+	// the curves are interpolated, so the result is measured once more
+	measure_allocation(best);
+	std::cout << " measurement done after " << search.measurements() + 1 << " measurements!" << std::endl
+			  << std::endl;
+
+	const auto masks = partition_masks(best);
+	const auto &rates = results.at(best);
+	std::vector<double> instructions, equal_instructions;
+	std::cout << "group \t\t mask \t\t weight \t llc/s \t\t instr/s \t instr(equal split) \t command" << std::endl;
+	for (size_t a = 0; a < applications.size(); ++a) {
+		instructions.push_back(rates[a].second);
+		equal_instructions.push_back(equal_rates[a].second);
+		std::cout << applications[a].name << " \t " << std::hex << masks[a].to_ullong() << std::dec << " \t\t "
+				  << applications[a].weight << " \t " << rates[a].first << " \t " << rates[a].second << " \t "
+				  << rates[a].second / equal_rates[a].second << " \t " << applications[a].command << std::endl;
+	}
+	std::cout << std::endl
+			  << "Weighted throughput: " << search.weighted_throughput(instructions) << " (predicted "
+			  << search.predicted_weighted_throughput(best) << ", equal split "
+			  << search.weighted_throughput(equal_instructions) << ")" << std::endl;
+
+	write_schemata(masks);
+	std::cout << "Schemata written to " << schemata_dir << "/<group>/schemata, apply them with" << std::endl
+			  << "  for g in " << schemata_dir << "/*; do" << std::endl
+			  << "    cat $g/schemata > /sys/fs/resctrl/$(basename $g)/schemata; done" << std::endl;
+}
+
 int main(int argc, char const *argv[]) {
 	parse_options(static_cast<size_t>(argc), argv);
 
-	std::cout << "CBM max: " << std::hex << get_cbm_mask_as_uint() << std::endl;
+	std::cout << "CBM max: " << std::hex << get_cbm_mask_as_uint() << std::dec << std::endl;
 	std::cout << "CBM min bits: " << get_min_cbm_bits() << std::endl;
 	std::cout << "Number of closids: " << get_num_closids() << std::endl;
 	std::cout << std::endl;
@@ -280,56 +565,62 @@ int main(int argc, char const *argv[]) {
 		std::cout << " done!\n\n";
 	}
 
-	auto perf_ids = init_perf();
+	const auto counters = init_perf();
+	if (!counters) return 1;
+
+	if (applications.empty()) {
+		setup_cat();
+		std::cout << "Analysing " << command << " " << std::flush;
+		execute_command(res_name, command, "cmd.log");
+	} else {
+		// the default group uses a CLOSID as well
+		if (!partition_search::can_partition(applications.size(), get_cbm_mask().count(), get_min_cbm_bits(),
+											 get_num_closids())) {
+			std::cerr << "The cache cannot be partitioned between " << applications.size() << " applications."
+					  << std::endl;
+			return 1;
+		}
+		for (const auto &a : applications) {
+			setup_group(a.name, a.cpus);
+			execute_command(a.name, a.command, a.name + ".log");
+		}
+		std::cout << "Partitioning the cache between " << applications.size() << " applications " << std::flush;
+	}
 
-	setup_cat();
+	// wait some time before we start measurements
+	std::this_thread::sleep_for(warmup_time);
 
-	std::cout << "Analysing " << command << " " << std::flush;
+	if (!applications.empty()) {
+		partition(*counters);
+		cleanup();
+	}
 
-	auto bits = create_minimal_bitset();
-	std::vector<double> llc_misses;
-	std::vector<double> instruction_count;
+	if (search_tolerance > 0.0) {
+		const sample knee = search_knee(*counters);
+		std::cout << std::endl
+				  << "Smallest mask within " << search_tolerance * 100.0 << "% of the full cache: " << std::hex
+				  << knee.mask.to_ullong() << std::dec << " (" << knee.mask.count() << " ways)" << std::endl;
+		cleanup();
+	}
 
-	execute_command(command);
-	// wait some time before we start measurements
-	std::this_thread::sleep_for(measurement_time * 9);
+	auto bits = brute_force ? general_all_bitmasks() : create_minimal_bitset();
+	std::vector<sample> samples;
 
 	// loop over all possible settings
-	while (true) {
-		if (brute_force) {
-			bits = general_all_bitmasks();
-			if (bits.count() == 0) break;
-		}
-
-		std::vector<size_t> schematas;
-		for (size_t n = 0; n < distgen_init.NUMA_domains; ++n) schematas.push_back(bits.to_ullong());
+	while (bits.count() != 0) {
 		try {
-			resgroup_set_schemata(res_name, schematas);
-		} catch (...) {
+			samples.push_back(measure(*counters, bits));
+		} catch (const std::runtime_error &) {
 			// ignore invalid masks
+			bits = brute_force ? general_all_bitmasks() : std::bitset<64>(0);
 			continue;
 		}
 
-		if (use_cache_clear) {
-			clear_cache();
-		}
-
-		start_perf_measurement(perf_ids);
-		std::this_thread::sleep_for(measurement_time);
-		stop_perf_measurement(perf_ids);
-
-		auto res = read_perf_measurement(perf_ids);
-
-		const long offset = static_cast<long>(distgen_init.number_of_threads);
-		llc_misses.push_back(std::accumulate(res.begin(), res.begin() + offset, 0.0));
-		instruction_count.push_back(std::accumulate(res.begin() + offset, res.end(), 0.0));
-
 		if (brute_force) {
-			auto i = llc_misses.size() - 1;
-
+			const auto &s = samples.back();
 			std::cout << std::endl
-					  << std::hex << bits.to_ullong() << std::flush << " \t\t " << std::dec << llc_misses[i] << " \t "
-					  << instruction_count[i] << std::flush;
+					  << std::hex << bits.to_ullong() << std::flush << " \t\t " << std::dec << s.llc_misses << " \t "
+					  << s.instructions << std::flush;
 
 			bits = general_all_bitmasks();
 		} else {
@@ -342,19 +633,12 @@ int main(int argc, char const *argv[]) {
 
 	std::cout << " measurement done!" << std::endl << std::endl;
 
-	bits = create_minimal_bitset();
-
-	const double max_cache = llc_misses[llc_misses.size() - 1];
-	const double max_instruction = instruction_count[instruction_count.size() - 1];
-
-	std::cout << "mask \t\t llc \t\t llc(nom) \t\t instr \t\t instr(nom)" << std::endl;
-	for (size_t i = 0; i < llc_misses.size(); ++i) {
-		std::cout << std::hex << bits.to_ullong() << " \t\t " << std::dec << llc_misses[i] << " \t "
-				  << llc_misses[i] / max_cache << " \t " << instruction_count[i] << " \t "
-				  << instruction_count[i] / max_instruction << std::endl;
-
-		// TODO broken when using brute-force
-		bits = increase_bitset(bits);
+	if (!samples.empty()) {
+		// the largest mask, which is the first one with brute force
+		const auto full = std::max_element(samples.begin(), samples.end(), [](const sample &a, const sample &b) {
+			return a.mask.count() < b.mask.count();
+		});
+		print_samples(samples, *full);
 	}
 
 	cleanup();
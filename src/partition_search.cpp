@@ -0,0 +1,168 @@
+#include "partition_search.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <utility>
+
+partition_search::partition_search(measure_fn _measure, std::vector<double> _weights, size_t _total_ways,
+								   size_t _min_ways, double _tolerance)
+	: measure(std::move(_measure)), weights(std::move(_weights)), total_ways(_total_ways), min_ways(_min_ways),
+	  tolerance(_tolerance), curves(weights.size()) {
+	assert(!weights.empty());
+	assert(min_ways > 0 && weights.size() * min_ways <= total_ways);
+}
+
+bool partition_search::can_partition(size_t apps, size_t total_ways, size_t min_ways, size_t closids) {
+	return apps > 0 && apps < closids && apps * min_ways <= total_ways;
+}
+
+partition_search::ways_t partition_search::run() {
+	measure_allocation(equal_split());
+
+	// the ends of every curve
+	for (size_t app = 0; app < weights.size(); ++app) {
+		if (curves[app].count(max_ways()) == 0) measure_allocation(allocation_for(app, max_ways()));
+		if (curves[app].count(min_ways) == 0) measure_allocation(allocation_for(app, min_ways));
+	}
+
+	bool refined = true;
+	while (refined) {
+		refined = false;
+		for (size_t app = 0; app < weights.size(); ++app) refined |= refine(app);
+	}
+
+	return best();
+}
+
+partition_search::ways_t partition_search::equal_split() const {
+	ways_t res(weights.size(), total_ways / weights.size());
+	for (size_t i = 0; i < total_ways % weights.size(); ++i) ++res[i];
+	return res;
+}
+
+double partition_search::predicted(size_t app, size_t ways) const {
+	const auto &curve = curves[app];
+	assert(!curve.empty());
+
+	const auto mean = [](const point &p) { return p.sum / static_cast<double>(p.count); };
+	const auto upper = curve.lower_bound(ways);
+	if (upper == curve.end()) return mean(curve.rbegin()->second);
+	if (upper->first == ways || upper == curve.begin()) return mean(upper->second);
+
+	const auto lower = std::prev(upper);
+	const double f =
+		static_cast<double>(ways - lower->first) / static_cast<double>(upper->first - lower->first);
+	return mean(lower->second) + f * (mean(upper->second) - mean(lower->second));
+}
+
+double partition_search::weighted_throughput(const std::vector<double> &throughput) const {
+	double res = 0.0;
+	for (size_t app = 0; app < weights.size(); ++app) {
+		const double full = predicted(app, max_ways());
+		if (full > 0.0) res += weights[app] * throughput[app] / full;
+	}
+	return res;
+}
+
+double partition_search::predicted_weighted_throughput(const ways_t &ways) const {
+	std::vector<double> throughput;
+	for (size_t app = 0; app < weights.size(); ++app) throughput.push_back(predicted(app, ways[app]));
+	return weighted_throughput(throughput);
+}
+
+void partition_search::measure_allocation(const ways_t &ways) {
+	const auto throughput = measure(ways);
+	assert(throughput.size() == weights.size());
+
+	for (size_t app = 0; app < weights.size(); ++app) {
+		auto &p = curves[app][ways[app]];
+		p.sum += throughput[app];
+		++p.count;
+	}
+	++count;
+}
+
+partition_search::ways_t partition_search::allocation_for(size_t app, size_t ways) const {
+	ways_t res(weights.size(), min_ways);
+	res[app] = ways;
+
+	// the others get different numbers of ways in every measurement, which adds points to their curves
+	size_t left = weights.size() > 1 ? total_ways - ways - (weights.size() - 1) * min_ways : 0;
+	for (size_t i = 0; left > 0; i = (i + 1) % weights.size()) {
+		if (i == app) continue;
+		++res[i];
+		--left;
+	}
+	return res;
+}
+
+bool partition_search::refine(size_t app) {
+	const auto &curve = curves[app];
+	const double full = predicted(app, max_ways());
+
+	for (auto it = curve.begin(); std::next(it) != curve.end(); ++it) {
+		const auto next = std::next(it);
+		if (next->first - it->first < 2) continue;
+		if (std::abs(predicted(app, next->first) - predicted(app, it->first)) <= tolerance * full) continue;
+
+		measure_allocation(allocation_for(app, it->first + (next->first - it->first) / 2));
+		return true;
+	}
+	return false;
+}
+
+partition_search::ways_t partition_search::best() const {
+	const size_t apps = weights.size();
+
+	// the ways worth considering for every application: more ways must gain more than tolerance
+	std::vector<std::vector<size_t>> candidates(apps);
+	for (size_t app = 0; app < apps; ++app) {
+		const double full = predicted(app, max_ways());
+		double last = -std::numeric_limits<double>::infinity();
+		for (size_t w = min_ways; w <= max_ways(); ++w) {
+			const double t = predicted(app, w);
+			if (t > last + tolerance * full) {
+				candidates[app].push_back(w);
+				last = t;
+			}
+		}
+	}
+
+	// value[w]: best weighted throughput of the applications so far using w ways
+	const double none = -std::numeric_limits<double>::infinity();
+	std::vector<double> value(total_ways + 1, none);
+	value[0] = 0.0;
+	// choice[app][w]: ways of app in the best allocation using w ways
+	std::vector<std::vector<size_t>> choice(apps, std::vector<size_t>(total_ways + 1, 0));
+
+	for (size_t app = 0; app < apps; ++app) {
+		const double full = predicted(app, max_ways());
+		std::vector<double> next(total_ways + 1, none);
+		for (size_t used = 0; used <= total_ways; ++used) {
+			if (value[used] == none) continue;
+			for (auto w : candidates[app]) {
+				if (used + w > total_ways) break;
+				const double v = value[used] + (full > 0.0 ? weights[app] * predicted(app, w) / full : 0.0);
+				if (v > next[used + w]) {
+					next[used + w] = v;
+					choice[app][used + w] = w;
+				}
+			}
+		}
+		value = std::move(next);
+	}
+
+	// the fewest ways among the best allocations
+	size_t used = 0;
+	for (size_t w = 0; w <= total_ways; ++w)
+		if (value[w] > value[used]) used = w;
+
+	ways_t res(apps, 0);
+	for (size_t app = apps; app > 0; --app) {
+		res[app - 1] = choice[app - 1][used];
+		used -= res[app - 1];
+	}
+	return res;
+}
@@ -0,0 +1,279 @@
+#include "passive.hpp"
+#include "perf_counters.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+#include <cstdlib>
+
+#include <dirent.h>
+
+static std::string read_first_line(const std::string &filename) {
+	std::ifstream file(filename);
+	std::string line;
+	if (!file.is_open() || !std::getline(file, line)) throw std::runtime_error("Could not read " + filename);
+	return line;
+}
+
+static std::vector<std::string> list_dir(const std::string &path) {
+	std::vector<std::string> res;
+	DIR *dir = opendir(path.c_str());
+	if (dir == nullptr) return res;
+
+	struct dirent *ent;
+	while ((ent = readdir(dir)) != nullptr) {
+		if (ent->d_name[0] == '.') continue;
+		res.emplace_back(ent->d_name);
+	}
+	closedir(dir);
+	return res;
+}
+
+static size_t node_of_cpu(const std::map<size_t, size_t> &cpu_to_node, size_t cpu) {
+	auto it = cpu_to_node.find(cpu);
+	if (it == cpu_to_node.end()) throw std::runtime_error("Unknown CPU " + std::to_string(cpu));
+	return it->second;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// perf uncore IMC
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+class imc_source : public bandwidth_source {
+public:
+	explicit imc_source(const std::map<size_t, size_t> &cpu_to_node) {
+		const std::string base(perf_sysfs_root() + "/bus/event_source/devices/");
+
+		for (const auto &dev : list_dir(base)) {
+			if (dev.compare(0, 10, "uncore_imc") != 0) continue;
+			const std::string path = base + dev + "/";
+
+			pmu p;
+			std::vector<std::string> events;
+			for (const char *event : {"cas_count_read", "cas_count_write"}) {
+				std::ifstream test(path + "events/" + event);
+				if (test.is_open()) events.push_back(dev + "/" + event + "/");
+			}
+			if (events.empty()) continue;
+
+			// the uncore PMU is opened once per package, on the CPU listed in cpumask
+			p.counters.reset(new perf_counters(events));
+			for (size_t e = 0; e < events.size(); ++e) {
+				// CAS events count cache lines if they have no unit
+				const double bytes = perf_event_bytes(p.counters->event(e));
+				p.scale.push_back(bytes > 0.0 ? bytes : 64.0);
+			}
+			for (const size_t cpu : p.counters->cpus()) p.nodes.push_back(node_of_cpu(cpu_to_node, cpu));
+			p.counters->start();
+			pmus.push_back(std::move(p));
+		}
+		if (pmus.empty()) throw std::runtime_error("No uncore IMC events found");
+	}
+
+	std::map<size_t, std::uint64_t> read_bytes() override {
+		std::map<size_t, std::uint64_t> res;
+		for (const auto &p : pmus) {
+			const auto counts = p.counters->read();
+			for (size_t i = 0; i < counts.size(); ++i) {
+				for (size_t e = 0; e < counts[i].size(); ++e) {
+					res[p.nodes[i]] += static_cast<std::uint64_t>(counts[i][e] * p.scale[e]);
+				}
+			}
+		}
+		return res;
+	}
+
+	std::string name() const override { return "imc"; }
+
+private:
+	// the events of one IMC, read as one group per package
+	struct pmu {
+		std::unique_ptr<perf_counters> counters;
+		std::vector<size_t> nodes;  // of the CPUs of counters
+		std::vector<double> scale;  // bytes per count of every event
+	};
+
+	std::vector<pmu> pmus;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// resctrl MBM
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+class mbm_source : public bandwidth_source {
+public:
+	explicit mbm_source(const std::map<size_t, size_t> &cpu_to_node) {
+		const char *env = std::getenv("PONRI_PATH");
+		const std::string root(env != nullptr ? env : "/sys/fs/resctrl");
+
+		// L3 domain -> NUMA node
+		std::map<size_t, size_t> l3_to_node;
+		for (const auto &cpu : cpu_to_node) {
+			const std::string id_file =
+				perf_sysfs_root() + "/devices/system/cpu/cpu" + std::to_string(cpu.first) + "/cache/index3/id";
+			std::ifstream id(id_file);
+			size_t l3;
+			if (id >> l3) l3_to_node.emplace(l3, cpu.second);
+		}
+
+		// the root group only counts tasks not in any other control group,
+		// so we sum up all control groups
+		std::vector<std::string> groups{root};
+		for (const auto &dir : list_dir(root)) {
+			if (dir == "info" || dir == "mon_data" || dir == "mon_groups") continue;
+			if (!list_dir(root + "/" + dir + "/mon_data").empty()) groups.push_back(root + "/" + dir);
+		}
+
+		for (const auto &group : groups) {
+			for (const auto &domain : list_dir(group + "/mon_data")) {
+				// mon_L3_<id>
+				if (domain.compare(0, 7, "mon_L3_") != 0) continue;
+				const auto it = l3_to_node.find(std::stoul(domain.substr(7)));
+				if (it == l3_to_node.end()) continue;
+				files.emplace_back(group + "/mon_data/" + domain + "/mbm_total_bytes", it->second);
+			}
+		}
+
+		if (files.empty()) throw std::runtime_error("No resctrl MBM counters found in " + root);
+		read_bytes();
+	}
+
+	std::map<size_t, std::uint64_t> read_bytes() override {
+		std::map<size_t, std::uint64_t> res;
+		for (const auto &f : files) {
+			// reads "Unavailable" if the counter is not ready
+			res[f.second] += std::stoull(read_first_line(f.first));
+		}
+		return res;
+	}
+
+	std::string name() const override { return "mbm"; }
+
+private:
+	// mbm_total_bytes file and its NUMA node
+	std::vector<std::pair<std::string, size_t>> files;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// file based source, for testing
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+class file_source : public bandwidth_source {
+public:
+	explicit file_source(const std::string &_dir) : dir(_dir) {
+		if (read_bytes().empty()) throw std::runtime_error("No node<N> files found in " + dir);
+	}
+
+	std::map<size_t, std::uint64_t> read_bytes() override {
+		std::map<size_t, std::uint64_t> res;
+		for (const auto &file : list_dir(dir)) {
+			if (file.compare(0, 4, "node") != 0) continue;
+			res[std::stoul(file.substr(4))] = std::stoull(read_first_line(dir + "/" + file));
+		}
+		return res;
+	}
+
+	std::string name() const override { return "file:" + dir; }
+
+private:
+	const std::string dir;
+};
+
+std::unique_ptr<bandwidth_source> make_bandwidth_source(const std::string &spec,
+														const std::map<size_t, size_t> &cpu_to_node) {
+	if (spec == "imc") return std::unique_ptr<bandwidth_source>(new imc_source(cpu_to_node));
+	if (spec == "mbm") return std::unique_ptr<bandwidth_source>(new mbm_source(cpu_to_node));
+	if (spec.compare(0, 5, "file:") == 0) return std::unique_ptr<bandwidth_source>(new file_source(spec.substr(5)));
+	if (spec == "auto") {
+		try {
+			return make_bandwidth_source("imc", cpu_to_node);
+		} catch (const std::exception &) {
+			return make_bandwidth_source("mbm", cpu_to_node);
+		}
+	}
+
+	throw std::runtime_error("Unknown bandwidth source " + spec);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// passive_monitor
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+passive_monitor::passive_monitor(std::unique_ptr<bandwidth_source> _source, std::chrono::milliseconds _interval,
+								 size_t _history)
+	: source(std::move(_source)), interval(_interval), history(_history > 0 ? _history : 1),
+	  thread(&passive_monitor::run, this) {}
+
+passive_monitor::~passive_monitor() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	cv.notify_all();
+	thread.join();
+}
+
+std::map<size_t, double> passive_monitor::bandwidth() const {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::map<size_t, double> res;
+	for (const auto &sample : samples) {
+		for (const auto &node : sample) res[node.first] += node.second / static_cast<double>(samples.size());
+	}
+	return res;
+}
+
+void passive_monitor::wait_for_sample(std::chrono::milliseconds timeout) const {
+	std::unique_lock<std::mutex> lock(mutex);
+	if (cv.wait_for(lock, timeout, [this] { return !samples.empty() || stop; })) return;
+	throw std::runtime_error("No sample within " + std::to_string(timeout.count()) + " ms" +
+							 (last_error.empty() ? std::string() : ": " + last_error));
+}
+
+void passive_monitor::run() {
+	auto last_time = std::chrono::steady_clock::now();
+	std::map<size_t, std::uint64_t> last;
+	std::string error;
+	try {
+		last = source->read_bytes();
+	} catch (const std::exception &e) {
+		// the first sample is lost
+		error = e.what();
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	last_error = error;
+
+	while (!cv.wait_for(lock, interval, [this] { return stop; })) {
+		lock.unlock();
+		const auto now_time = std::chrono::steady_clock::now();
+		std::map<size_t, std::uint64_t> now;
+		try {
+			now = source->read_bytes();
+		} catch (const std::exception &e) {
+			// e.g. an MBM counter that is temporarily unavailable, skip this sample
+			lock.lock();
+			last_error = e.what();
+			continue;
+		}
+
+		const double seconds = std::chrono::duration<double>(now_time - last_time).count();
+		std::map<size_t, double> sample;
+		for (const auto &node : now) {
+			const auto it = last.find(node.first);
+			// counters may wrap or be reset
+			if (it == last.end() || it->second > node.second) continue;
+			sample[node.first] = gbyte_per_s(static_cast<double>(node.second - it->second), seconds);
+		}
+		const bool first = last.empty();
+		last = now;
+		last_time = now_time;
+
+		lock.lock();
+		// without a previous read there is nothing to compare with
+		if (first) continue;
+		samples.push_back(sample);
+		if (samples.size() > history) samples.pop_front();
+		cv.notify_all();
+	}
+}
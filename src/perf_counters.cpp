@@ -0,0 +1,408 @@
+#include "perf_counters.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+std::string perf_sysfs_root() {
+	const char *root = std::getenv("MMBWMON_SYSFS");
+	return (root != nullptr) ? root : "/sys";
+}
+
+int perf_event_open(struct perf_event_attr *hw_event, pid_t pid, int cpu, int group_fd, unsigned long flags) {
+	return static_cast<int>(syscall(__NR_perf_event_open, hw_event, pid, cpu, group_fd, flags));
+}
+
+static std::string read_first_line(const std::string &filename) {
+	std::ifstream file(filename);
+	std::string line;
+	if (!file.is_open() || !std::getline(file, line)) throw std::runtime_error("Could not read " + filename);
+	return line;
+}
+
+// parses a kernel CPU list, e.g. "0-3,8"
+static std::vector<size_t> parse_cpulist(const std::string &list) {
+	std::vector<size_t> res;
+	std::stringstream ranges(list);
+	std::string range;
+	while (std::getline(ranges, range, ',')) {
+		const auto dash = range.find('-');
+		const size_t from = std::stoul(range.substr(0, dash));
+		const size_t to = (dash == std::string::npos) ? from : std::stoul(range.substr(dash + 1));
+		for (size_t cpu = from; cpu <= to; ++cpu) res.push_back(cpu);
+	}
+	return res;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// event names
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const struct {
+	const char *name;
+	__u32 type;
+	__u64 config;
+} generic_events[] = {
+	{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{"cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+	{"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	{"branch-instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+	{"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	{"bus-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BUS_CYCLES},
+	{"ref-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES},
+	{"cpu-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK},
+	{"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+	{"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+	{"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+	{"cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+};
+
+// sets the bits of value in the fields of attr described by format, e.g.
+// "config:0-7" or "config1:0-3,32-35"
+static void apply_format(perf_event_attr &attr, const std::string &format, __u64 value) {
+	const auto colon = format.find(':');
+	const std::string field = format.substr(0, colon);
+	__u64 *config = nullptr;
+	if (field == "config") config = &attr.config;
+	if (field == "config1") config = &attr.config1;
+	if (field == "config2") config = &attr.config2;
+	if (config == nullptr || colon == std::string::npos) throw std::runtime_error("Unsupported format " + format);
+
+	std::stringstream ranges(format.substr(colon + 1));
+	std::string range;
+	while (std::getline(ranges, range, ',')) {
+		const auto dash = range.find('-');
+		const unsigned long lo = std::stoul(range.substr(0, dash));
+		const unsigned long hi = (dash == std::string::npos) ? lo : std::stoul(range.substr(dash + 1));
+		for (unsigned long bit = lo; bit <= hi && bit < 64; ++bit) {
+			if (value & 1) *config |= 1ull << bit;
+			value >>= 1;
+		}
+	}
+}
+
+// translates terms (e.g. "event=0x04,umask=0x03") into the config of attr using
+// the format definitions of the PMU in path
+static void apply_terms(perf_event_attr &attr, const std::string &path, const std::string &terms) {
+	std::stringstream list(terms);
+	std::string term;
+	while (std::getline(list, term, ',')) {
+		const auto eq = term.find('=');
+		const std::string key = term.substr(0, eq);
+		const __u64 value = (eq == std::string::npos) ? 1 : std::stoull(term.substr(eq + 1), nullptr, 0);
+		apply_format(attr, read_first_line(path + "format/" + key), value);
+	}
+}
+
+perf_event_desc perf_event_from_name(const std::string &spec) {
+	perf_event_desc res;
+	memset(&res.attr, 0, sizeof(perf_event_attr));
+	res.attr.size = sizeof(struct perf_event_attr);
+
+	// modifiers as in perf, e.g. "instructions:u"
+	std::string name = spec;
+	const auto colon = name.rfind(':');
+	if (colon != std::string::npos && name.find('/', colon) == std::string::npos) {
+		for (const char m : name.substr(colon + 1)) {
+			if (m == 'u') {
+				res.attr.exclude_kernel = 1;
+				res.attr.exclude_hv = 1;
+			} else if (m == 'k') {
+				res.attr.exclude_user = 1;
+				res.attr.exclude_hv = 1;
+			} else {
+				throw std::runtime_error("Unknown modifier in event " + spec);
+			}
+		}
+		name = name.substr(0, colon);
+	}
+
+	const auto slash = name.find('/');
+	if (slash == std::string::npos) {
+		for (const auto &e : generic_events) {
+			if (name != e.name) continue;
+			res.attr.type = e.type;
+			res.attr.config = e.config;
+			return res;
+		}
+		throw std::runtime_error("Unknown event " + spec);
+	}
+
+	// <pmu>/<event or terms>/
+	if (name.back() != '/' || name.size() < slash + 2) throw std::runtime_error("Malformed event " + spec);
+	const std::string path = perf_sysfs_root() + "/bus/event_source/devices/" + name.substr(0, slash) + "/";
+	const std::string event = name.substr(slash + 1, name.size() - slash - 2);
+	res.attr.type = static_cast<__u32>(std::stoul(read_first_line(path + "type")));
+
+	if (event.find('=') != std::string::npos || event.find(',') != std::string::npos) {
+		apply_terms(res.attr, path, event);
+	} else {
+		apply_terms(res.attr, path, read_first_line(path + "events/" + event));
+		std::ifstream scale_file(path + "events/" + event + ".scale");
+		std::ifstream unit_file(path + "events/" + event + ".unit");
+		scale_file >> res.scale;
+		unit_file >> res.unit;
+	}
+
+	std::ifstream cpumask(path + "cpumask");
+	std::string cpus;
+	if (std::getline(cpumask, cpus) && !cpus.empty()) res.cpus = parse_cpulist(cpus);
+	return res;
+}
+
+double perf_event_bytes(const perf_event_desc &event) {
+	static const struct {
+		const char *unit;
+		double bytes;
+	} units[] = {
+		{"Bytes", 1.0}, {"B", 1.0}, {"KiB", 1024.0}, {"MiB", 1024.0 * 1024.0}, {"GiB", 1024.0 * 1024.0 * 1024.0},
+	};
+	for (const auto &u : units) {
+		if (event.unit == u.unit) return event.scale * u.bytes;
+	}
+	return 0.0;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// perf_counters
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const __u64 group_format =
+	PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+// opens the events as one group, returns the fds, the leader first
+static std::vector<int> open_group(std::vector<perf_event_desc> &descs, const std::vector<std::string> &events,
+								   pid_t pid, int cpu, unsigned long flags) {
+	std::vector<int> res;
+	for (size_t e = 0; e < descs.size(); ++e) {
+		perf_event_attr &attr = descs[e].attr;
+		attr.read_format = group_format;
+		attr.disabled = (e == 0);
+		const int fd = perf_event_open(&attr, pid, cpu, res.empty() ? -1 : res[0], flags);
+		if (fd == -1) {
+			const std::string error = strerror(errno);
+			for (const int f : res) close(f);
+			throw std::runtime_error("Could not open " + events[e] +
+									 (cpu >= 0 ? " on CPU " + std::to_string(cpu) : std::string()) + ": " + error);
+		}
+		res.push_back(fd);
+	}
+	return res;
+}
+
+perf_counters::perf_counters(const std::vector<std::string> &events, const std::vector<size_t> &cpus,
+							 const std::string &cgroup) {
+	if (events.empty()) throw std::runtime_error("No events given");
+	for (const auto &e : events) {
+		descs.push_back(perf_event_from_name(e));
+		if (descs.back().attr.type != descs[0].attr.type) {
+			throw std::runtime_error("The events " + events[0] + " and " + e + " belong to different PMUs");
+		}
+	}
+
+	cpu_list = cpus;
+	if (cpu_list.empty()) cpu_list = descs[0].cpus;
+	if (cpu_list.empty()) cpu_list = parse_cpulist(read_first_line(perf_sysfs_root() + "/devices/system/cpu/online"));
+
+	pid_t pid = -1;
+	unsigned long flags = 0;
+	if (!cgroup.empty()) {
+		pid = open(cgroup.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (pid == -1) throw std::runtime_error("Could not open cgroup " + cgroup + ": " + strerror(errno));
+		flags = PERF_FLAG_PID_CGROUP;
+	}
+
+	try {
+		for (const size_t cpu : cpu_list) fds.push_back(open_group(descs, events, pid, static_cast<int>(cpu), flags));
+	} catch (...) {
+		for (const auto &group : fds)
+			for (const int fd : group) close(fd);
+		if (pid != -1) close(pid);
+		throw;
+	}
+	// the events keep a reference to the cgroup
+	if (pid != -1) close(pid);
+
+	baseline.resize(fds.size());
+	for (auto &b : baseline) b.counts.assign(descs.size(), 0);
+}
+
+perf_counters::~perf_counters() {
+	for (const auto &group : fds)
+		for (const int fd : group) close(fd);
+}
+
+void perf_counters::start() {
+	for (const auto &group : fds) ioctl(group[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	// resetting the counts would not reset the times used for scaling
+	for (size_t g = 0; g < fds.size(); ++g) baseline[g] = read_group(g);
+}
+
+void perf_counters::stop() {
+	for (const auto &group : fds) ioctl(group[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+perf_counters::group_value perf_counters::read_group(size_t group) const {
+	// nr, time_enabled, time_running, one value per event
+	std::vector<std::uint64_t> buf(3 + descs.size());
+	const auto bytes = static_cast<ssize_t>(buf.size() * sizeof(std::uint64_t));
+	if (::read(fds[group][0], buf.data(), buf.size() * sizeof(std::uint64_t)) != bytes || buf[0] != descs.size()) {
+		throw std::runtime_error("Could not read perf events of CPU " + std::to_string(cpu_list[group]));
+	}
+
+	group_value res;
+	res.enabled = buf[1];
+	res.running = buf[2];
+	res.counts.assign(buf.begin() + 3, buf.end());
+	return res;
+}
+
+std::vector<std::vector<double>> perf_counters::read() const {
+	std::vector<std::vector<double>> res(fds.size());
+	for (size_t g = 0; g < fds.size(); ++g) {
+		const group_value v = read_group(g);
+		const group_value &b = baseline[g];
+
+		// a group that has not been scheduled at all counted nothing
+		const std::uint64_t running = v.running - b.running;
+		const double scale = (running == 0) ? 0.0 : static_cast<double>(v.enabled - b.enabled) / running;
+		for (size_t e = 0; e < descs.size(); ++e) {
+			res[g].push_back(static_cast<double>(v.counts[e] - b.counts[e]) * scale);
+		}
+	}
+	return res;
+}
+
+double perf_counters::running_fraction() const {
+	double res = 1.0;
+	for (size_t g = 0; g < fds.size(); ++g) {
+		const group_value v = read_group(g);
+		const std::uint64_t enabled = v.enabled - baseline[g].enabled;
+		if (enabled > 0) res = std::min(res, static_cast<double>(v.running - baseline[g].running) / enabled);
+	}
+	return res;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// perf_self_counters
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline std::uint64_t rdpmc(std::uint32_t counter) {
+	std::uint32_t low, high;
+	asm volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+	return low | static_cast<std::uint64_t>(high) << 32;
+}
+
+static inline std::uint64_t rdtsc() {
+	std::uint32_t low, high;
+	asm volatile("rdtsc" : "=a"(low), "=d"(high));
+	return low | static_cast<std::uint64_t>(high) << 32;
+}
+#endif
+
+// reads an event from its perf page as described in linux/perf_event.h. Returns
+// false if the event is not on the PMU right now or user space reads are not
+// allowed.
+static bool read_page(const volatile perf_event_mmap_page *pc, std::uint64_t &count, std::uint64_t &enabled,
+					  std::uint64_t &running) {
+#if defined(__x86_64__) || defined(__i386__)
+	std::uint32_t seq;
+	do {
+		seq = pc->lock;
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+
+		const std::uint32_t index = pc->index;
+		if (!pc->cap_user_rdpmc || index == 0) return false;
+
+		enabled = pc->time_enabled;
+		running = pc->time_running;
+		if (pc->cap_user_time) {
+			// the times are only updated when the event is scheduled, add the time since then
+			const std::uint64_t cycles = rdtsc();
+			const std::uint16_t shift = pc->time_shift;
+			const std::uint32_t mult = pc->time_mult;
+			const std::uint64_t delta =
+				pc->time_offset + (cycles >> shift) * mult + (((cycles & ((1ull << shift) - 1)) * mult) >> shift);
+			enabled += delta;
+			running += delta;
+		}
+
+		// the counter is pmc_width bits wide and sign extended
+		const unsigned width = pc->pmc_width;
+		std::int64_t pmc = static_cast<std::int64_t>(rdpmc(index - 1) << (64 - width)) >> (64 - width);
+		count = static_cast<std::uint64_t>(pc->offset + pmc);
+
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+	} while (pc->lock != seq);
+	return true;
+#else
+	(void)pc;
+	(void)count;
+	(void)enabled;
+	(void)running;
+	return false;
+#endif
+}
+
+perf_self_counters::perf_self_counters(const std::vector<std::string> &events) {
+	if (events.empty()) throw std::runtime_error("No events given");
+	std::vector<perf_event_desc> descs;
+	for (const auto &e : events) descs.push_back(perf_event_from_name(e));
+	fds = open_group(descs, events, 0, -1, 0);
+
+	const long page_size = sysconf(_SC_PAGESIZE);
+	for (const int fd : fds) {
+		void *page = mmap(nullptr, static_cast<size_t>(page_size), PROT_READ, MAP_SHARED, fd, 0);
+		// without the page read() is used
+		pages.push_back(page == MAP_FAILED ? nullptr : page);
+	}
+
+	ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+perf_self_counters::~perf_self_counters() {
+	const long page_size = sysconf(_SC_PAGESIZE);
+	for (void *page : pages) {
+		if (page != nullptr) munmap(page, static_cast<size_t>(page_size));
+	}
+	for (const int fd : fds) close(fd);
+}
+
+std::vector<double> perf_self_counters::read() const {
+	std::vector<double> res;
+	rdpmc_used = true;
+	for (size_t e = 0; e < fds.size() && rdpmc_used; ++e) {
+		std::uint64_t count, enabled, running;
+		if (pages[e] == nullptr || !read_page(static_cast<const perf_event_mmap_page *>(pages[e]), count, enabled,
+											  running)) {
+			rdpmc_used = false;
+			break;
+		}
+		res.push_back(running == 0 ? 0.0 : static_cast<double>(count) * enabled / running);
+	}
+	if (rdpmc_used) return res;
+
+	std::vector<std::uint64_t> buf(3 + fds.size());
+	const auto bytes = static_cast<ssize_t>(buf.size() * sizeof(std::uint64_t));
+	if (::read(fds[0], buf.data(), buf.size() * sizeof(std::uint64_t)) != bytes) {
+		throw std::runtime_error("Could not read perf events");
+	}
+	const double scale = (buf[2] == 0) ? 0.0 : static_cast<double>(buf[1]) / buf[2];
+	res.clear();
+	for (size_t e = 0; e < fds.size(); ++e) res.push_back(static_cast<double>(buf[3 + e]) * scale);
+	return res;
+}
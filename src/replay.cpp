@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+
+#include <fast-lib/message/agent/mmbwmon/request.hpp>
+
+#include "perf_counters.hpp"
+#include "request_scheduler.hpp"
+#include "trace.hpp"
+
+[[noreturn]] static void print_help(const char *argv) {
+	std::cout << argv << " <trace> replays a trace of mmbwmon --record and supports the following flags:\n";
+	std::cout << "\t --coalesce-window Requests arriving within <ms> are handled together. \t Default: as recorded\n";
+	std::cout << "\t --cache-ttl \t Results younger than <ms> are reused. \t\t Default: as recorded\n";
+	std::cout << "\t --repeat \t Replay <n> times and report the fastest. \t Default: 1\n";
+	exit(0);
+}
+
+static std::string trace_path;
+static long window_ms = -1;
+static long ttl_ms = -1;
+static size_t repeat = 1;
+
+static void parse_options(size_t argc, const char **argv) {
+	for (size_t i = 1; i < argc; ++i) {
+		std::string arg(argv[i]);
+
+		if (arg == "--coalesce-window") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			window_ms = std::stol(std::string(argv[i + 1]));
+			++i;
+			continue;
+		}
+		if (arg == "--cache-ttl") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			ttl_ms = std::stol(std::string(argv[i + 1]));
+			++i;
+			continue;
+		}
+		if (arg == "--repeat") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			repeat = std::max(1ul, std::stoul(std::string(argv[i + 1])));
+			++i;
+			continue;
+		}
+		if (arg.compare(0, 2, "--") == 0 || trace_path != "") print_help(argv[0]);
+		trace_path = arg;
+	}
+
+	if (trace_path == "") print_help(argv[0]);
+}
+
+struct request_event {
+	request_scheduler::clock::time_point time;
+	request_scheduler::cores_t cores;
+};
+
+// the recorded trace
+static trace_header header;
+static std::vector<request_event> requests;
+static std::map<request_scheduler::cores_t, std::vector<request_scheduler::measurement>> recorded;
+static size_t recorded_measurements = 0, recorded_replies = 0, recorded_cached = 0, skipped = 0;
+static double recorded_duration = 0.0;
+
+static void load_trace() {
+	trace_reader reader(trace_path);
+	header = reader.header();
+
+	trace_record r;
+	try {
+		while (reader.next(r)) {
+			if (r.kind == trace_record::measurement) {
+				recorded[r.cores].push_back(r.result);
+				++recorded_measurements;
+				recorded_duration += r.result.duration;
+			} else if (r.kind == trace_record::reply) {
+				++recorded_replies;
+				if (r.age > 0.0) ++recorded_cached;
+			} else {
+				// validated like bench_thread() does
+				fast::msg::agent::mmbwmon::request req;
+				try {
+					req.from_string(r.payload);
+				} catch (const std::exception &) {
+					++skipped;
+					continue;
+				}
+				bool valid = !req.cores.empty();
+				for (auto c : req.cores) valid &= (c < header.nodes.size());
+				if (!valid) {
+					++skipped;
+					continue;
+				}
+
+				request_scheduler::cores_t cores = req.cores;
+				std::sort(cores.begin(), cores.end());
+				cores.erase(std::unique(cores.begin(), cores.end()), cores.end());
+				const auto time = std::chrono::duration_cast<request_scheduler::clock::duration>(
+					std::chrono::nanoseconds(r.time_ns));
+				requests.push_back(request_event{request_scheduler::clock::time_point(time), std::move(cores)});
+			}
+		}
+	} catch (const std::exception &e) {
+		std::cerr << "Stopping at a damaged record: " << e.what() << std::endl;
+	}
+}
+
+struct replay_result {
+	double wall = 0.0;     // seconds the replay took
+	double measuring = 0.0; // simulated seconds spent measuring
+	size_t measurements = 0, synthesized = 0, replies = 0, cached = 0;
+	std::vector<double> latencies; // simulated seconds from request to reply
+	// user space instructions and cycles of the replay, < 0 if they could not be counted
+	double instructions = -1.0, cycles = -1.0;
+};
+
+static replay_result replay() {
+	replay_result res;
+
+	// the simulated distgen: the recorded results of a core set in order, the last one repeated,
+	// and the mean recorded duration for core sets that were never measured
+	std::map<request_scheduler::cores_t, size_t> next;
+	const double mean_duration = recorded_measurements > 0 ? recorded_duration / recorded_measurements : 0.1;
+	const auto measure = [&](const request_scheduler::cores_t &cores) {
+		++res.measurements;
+		const auto it = recorded.find(cores);
+		request_scheduler::measurement m{1.0, 0.0, mean_duration, -1.0};
+		if (it == recorded.end()) {
+			++res.synthesized;
+		} else {
+			size_t &i = next[cores];
+			m = it->second[std::min(i, it->second.size() - 1)];
+			++i;
+		}
+		res.measuring += m.duration;
+		return m;
+	};
+
+	// the arrival times of the requests waiting for a core set, like bench_thread()
+	std::map<request_scheduler::cores_t, std::vector<request_scheduler::clock::time_point>> waiting;
+	request_scheduler *scheduler = nullptr;
+	const auto reply = [&](const request_scheduler::cores_t &cores, const request_scheduler::measurement &,
+						   double age) {
+		++res.replies;
+		if (age > 0.0) ++res.cached;
+		const auto it = waiting.find(cores);
+		if (it == waiting.end()) return;
+		for (auto t : it->second)
+			res.latencies.push_back(std::chrono::duration<double>(scheduler->now() - t).count());
+		waiting.erase(it);
+	};
+
+	const auto window = std::chrono::milliseconds(window_ms >= 0 ? window_ms : static_cast<long>(header.window_ms));
+	const auto ttl = std::chrono::milliseconds(ttl_ms >= 0 ? ttl_ms : static_cast<long>(header.ttl_ms));
+	const auto node_of = [](size_t core) { return static_cast<size_t>(header.nodes[core]); };
+
+	// the simulated distgen costs next to nothing, so this is the cost of the scheduler. The whole
+	// replay runs on this thread, which is what perf_self_counters counts.
+	std::unique_ptr<perf_self_counters> counters;
+	try {
+		counters.reset(new perf_self_counters({"instructions:u", "cycles:u"}));
+	} catch (const std::exception &) {
+		// e.g. in a VM without a virtual PMU
+	}
+	const std::vector<double> before = counters ? counters->read() : std::vector<double>();
+
+	const auto start = std::chrono::steady_clock::now();
+	request_scheduler s(measure, node_of, reply, window, ttl, request_scheduler::simulated_t{});
+	scheduler = &s;
+	for (const auto &r : requests) {
+		s.advance_to(r.time);
+		// like bench_thread(), a core set with waiting requests is not submitted again
+		auto &arrivals = waiting[r.cores];
+		arrivals.push_back(r.time);
+		if (arrivals.size() == 1) s.submit(r.cores);
+	}
+	s.advance_to(request_scheduler::clock::time_point::max());
+	res.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (counters) {
+		const std::vector<double> after = counters->read();
+		res.instructions = after[0] - before[0];
+		res.cycles = after[1] - before[1];
+	}
+	return res;
+}
+
+// the p quantile of the sorted values
+static double quantile(const std::vector<double> &sorted, double p) {
+	if (sorted.empty()) return 0.0;
+	return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * static_cast<double>(sorted.size())))];
+}
+
+int main(int argc, char const *argv[]) {
+	parse_options(static_cast<size_t>(argc), argv);
+
+	try {
+		load_trace();
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	replay_result res;
+	for (size_t i = 0; i < repeat; ++i) {
+		replay_result r = replay();
+		if (i == 0 || r.wall < res.wall) res = std::move(r);
+	}
+
+	const double span =
+		requests.empty() ? 0.0 : std::chrono::duration<double>(requests.back().time.time_since_epoch()).count();
+	std::cout << "Replayed " << requests.size() << " requests (" << skipped << " skipped) spanning " << span
+			  << " s in " << res.wall * 1000.0 << " ms, " << static_cast<double>(requests.size()) / res.wall
+			  << " requests/s\n";
+	std::cout << "Measurements: " << res.measurements << " (recorded " << recorded_measurements << ", "
+			  << res.synthesized << " without recorded result), " << res.measuring << " s measuring\n";
+	std::cout << "Replies: " << res.replies << ", " << res.cached << " from the cache (recorded " << recorded_replies
+			  << ", " << recorded_cached << " from the cache)\n";
+	if (res.instructions >= 0.0 && !requests.empty()) {
+		const double n = static_cast<double>(requests.size());
+		std::cout << "Per request: " << res.instructions / n << " instructions, " << res.cycles / n << " cycles\n";
+	}
+
+	std::sort(res.latencies.begin(), res.latencies.end());
+	double sum = 0.0;
+	for (auto l : res.latencies) sum += l;
+	std::cout << "Latency in ms: mean "
+			  << (res.latencies.empty() ? 0.0 : sum / static_cast<double>(res.latencies.size()) * 1000.0)
+			  << ", median " << quantile(res.latencies, 0.5) * 1000.0 << ", 99th percentile "
+			  << quantile(res.latencies, 0.99) * 1000.0 << ", max "
+			  << (res.latencies.empty() ? 0.0 : res.latencies.back() * 1000.0) << std::endl;
+}
@@ -1,24 +1,47 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include <cstring>
 
+#include <fast-lib/message/agent/mmbwmon/client.hpp>
 #include <fast-lib/message/agent/mmbwmon/reply.hpp>
 #include <fast-lib/message/agent/mmbwmon/request.hpp>
+#include <fast-lib/local_communicator.hpp>
 #include <fast-lib/mqtt_communicator.hpp>
 
 #include "helper.hpp"
 
 [[noreturn]] static void print_help(const char *argv) {
 	std::cout << argv << " supports the following flags:\n";
-	std::cout << "\t --server \t URI of the MQTT broker. \t\t\t Required!\n";
+	std::cout << "\t --server \t URI of the MQTT broker. \t\t\t Required without --local!\n";
 	std::cout << "\t --port \t Port of the MQTT broker. \t\t\t Default: 1883\n";
+	std::cout << "\t --local \t Ask the agent on the Unix socket <path> instead of using MQTT. Default: off\n";
 	std::cout << "\t --core \t Core to be used by distgen. \t\t\t Can be used multiple times\n";
+	std::cout << "\t --set \t\t Comma separated core set, e.g. 0,1,2. \t Can be used multiple times\n";
+	std::cout << "\t --binary \t Use the binary encoding instead of YAML. \t Default: false\n";
+	std::cout << "\t --pipeline \t Send <n> requests over the core sets without waiting and print the latencies. Default: off\n";
 	exit(0);
 }
 
 static std::vector<size_t> cores;
+static std::vector<std::vector<size_t>> sets;
+static bool binary = false;
+static size_t pipeline = 0;
+
+static std::vector<size_t> parse_set(const std::string &str) {
+	std::vector<size_t> res;
+	std::istringstream in(str);
+	std::string core;
+	while (std::getline(in, core, ',')) res.push_back(std::stoul(core));
+	return res;
+}
 
 static void parse_options(size_t argc, const char **argv) {
 	if (argc == 1) {
@@ -52,9 +75,83 @@ static void parse_options(size_t argc, const char **argv) {
 			++i;
 			continue;
 		}
+		if (arg == "--local") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			local_socket = std::string(argv[i + 1]);
+			++i;
+			continue;
+		}
+		if (arg == "--set") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			sets.push_back(parse_set(std::string(argv[i + 1])));
+			++i;
+			continue;
+		}
+		if (arg == "--binary") {
+			binary = true;
+			continue;
+		}
+		if (arg == "--pipeline") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			pipeline = std::stoul(std::string(argv[i + 1]));
+			++i;
+			continue;
+		}
 	}
 
-	if (server == "") print_help(argv[0]);
+	if (!cores.empty()) sets.insert(sets.begin(), cores);
+	if (server == "" && local_socket == "") print_help(argv[0]);
+	if (sets.empty()) print_help(argv[0]);
+}
+
+// sends n requests round robin over the core sets at once and prints the
+// distribution of the round trip times
+static void run_pipeline(fast::msg::agent::mmbwmon::client &client, size_t n) {
+	using clock = std::chrono::steady_clock;
+	std::vector<clock::time_point> sent(n);
+	// set by the callbacks on arrival, the time_point of epoch if the request failed
+	std::vector<clock::time_point> received(n);
+	std::atomic<size_t> remaining(n);
+	std::promise<void> done;
+
+	const auto start = clock::now();
+	for (size_t i = 0; i < n; ++i) {
+		sent[i] = clock::now();
+		client.submit(sets[i % sets.size()], [&, i](std::future<fast::msg::agent::mmbwmon::reply> reply) {
+			try {
+				reply.get();
+				received[i] = clock::now();
+			} catch (const std::exception &e) {
+				std::cerr << "Request " << i << " failed: " << e.what() << std::endl;
+			}
+			if (--remaining == 0) done.set_value();
+		});
+	}
+	done.get_future().wait();
+	const std::chrono::duration<double> total = clock::now() - start;
+
+	std::vector<double> latencies;
+	for (size_t i = 0; i < n; ++i) {
+		if (received[i] == clock::time_point()) continue;
+		const std::chrono::duration<double, std::micro> l = received[i] - sent[i];
+		latencies.push_back(l.count());
+	}
+
+	std::cout << n << " requests over " << sets.size() << " core set(s) in " << total.count() * 1e3 << " ms ("
+			  << static_cast<double>(n) / total.count() << " requests/s), " << n - latencies.size() << " failed\n";
+	if (latencies.empty()) return;
+	std::sort(latencies.begin(), latencies.end());
+	const auto pct = [&latencies](double p) {
+		return latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * static_cast<double>(latencies.size())))];
+	};
+	std::cout << "round trip in us: min " << latencies.front() << ", p50 " << pct(0.5) << ", p90 " << pct(0.9)
+			  << ", p99 " << pct(0.99) << ", max " << latencies.back() << "\n";
 }
 
 int main(int argc, char const *argv[]) {
@@ -62,16 +159,28 @@ int main(int argc, char const *argv[]) {
 
 	parse_options(static_cast<size_t>(argc), argv);
 
-	fast::MQTT_communicator comm(requestID, baseTopic + "/response", baseTopic + "/request", server,
-								 static_cast<int>(port), 60);
-
-	std::cout << "MQTT ready!\n\n";
+	std::unique_ptr<fast::Communicator> comm;
+	if (local_socket != "") {
+		comm.reset(new fast::Local_communicator(local_socket, fast::Local_communicator::role::client,
+												baseTopic + "/response", baseTopic + "/request", std::chrono::seconds(10)));
+		std::cout << "Connected to " << local_socket << "\n\n";
+	} else {
+		comm.reset(new fast::MQTT_communicator(requestID, baseTopic + "/response", baseTopic + "/request", server,
+											   static_cast<int>(port), 60));
+		std::cout << "MQTT ready!\n\n";
+	}
 
-	fast::msg::agent::mmbwmon::request r(cores);
-	std::cout << "Going to send message:\n" << r.to_string() << "\n";
-	comm.send_message(r.to_string());
+	fast::msg::agent::mmbwmon::client client(*comm, baseTopic + "/request", baseTopic + "/response", binary);
+	if (pipeline > 0) {
+		run_pipeline(client, pipeline);
+		return 0;
+	}
 
-	fast::msg::agent::mmbwmon::reply reply;
-	reply.from_string(comm.get_message());
-	std::cout << "Got the following reply:\n" << reply.to_string() << "\n";
+	for (const auto &set : sets) {
+		std::cout << "Going to send message:\n" << fast::msg::agent::mmbwmon::request(set).to_string() << "\n";
+		const auto start = std::chrono::steady_clock::now();
+		const fast::msg::agent::mmbwmon::reply reply = client.submit(set).get();
+		const std::chrono::duration<double, std::micro> round_trip = std::chrono::steady_clock::now() - start;
+		std::cout << "Got the following reply after " << round_trip.count() << " us:\n" << reply.to_string() << "\n";
+	}
 }
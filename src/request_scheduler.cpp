@@ -0,0 +1,175 @@
+#include "request_scheduler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <set>
+
+request_scheduler::request_scheduler(measure_fn _measure, node_fn _node_of, reply_fn _reply,
+									 std::chrono::milliseconds _window, std::chrono::milliseconds _ttl)
+	: measure(std::move(_measure)), node_of(std::move(_node_of)), reply(std::move(_reply)), window(_window),
+	  ttl(_ttl), thread(&request_scheduler::run, this) {}
+
+request_scheduler::request_scheduler(measure_fn _measure, node_fn _node_of, reply_fn _reply,
+									 std::chrono::milliseconds _window, std::chrono::milliseconds _ttl, simulated_t)
+	: measure(std::move(_measure)), node_of(std::move(_node_of)), reply(std::move(_reply)), window(_window),
+	  ttl(_ttl), simulated(true) {}
+
+request_scheduler::~request_scheduler() {
+	if (simulated) return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	cv.notify_all();
+	thread.join();
+}
+
+void request_scheduler::submit(cores_t cores) {
+	std::sort(cores.begin(), cores.end());
+	cores.erase(std::unique(cores.begin(), cores.end()), cores.end());
+
+	// a fresh result is sent at once, a simulated cache may hold results finishing after the arrival
+	const auto arrival = simulated ? sim_target : clock::now();
+	std::unique_lock<std::mutex> cache_lock(cache_mutex);
+	const auto it = cache.find(cores);
+	if (it != cache.end() && it->second.time <= arrival && arrival - it->second.time < ttl) {
+		const cache_entry hit = it->second;
+		cache_lock.unlock();
+		if (simulated) sim_reply = arrival;
+		reply(cores, hit.result, std::chrono::duration<double>(arrival - hit.time).count());
+		return;
+	}
+	cache_lock.unlock();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (pending.empty()) first_pending = sim_target;
+		pending.push_back(std::move(cores));
+	}
+	cv.notify_all();
+}
+
+void request_scheduler::advance_to(clock::time_point time) {
+	// only a simulated scheduler has a virtual clock, and it never goes back
+	assert(simulated);
+	assert(time >= sim_target);
+	sim_target = time;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!pending.empty()) {
+		// like run(): the window opens when a request waits and the last batch is done
+		const auto close = std::max(first_pending, sim_now) + window;
+		if (close > time) break;
+		sim_now = close;
+
+		std::vector<cores_t> batch;
+		batch.swap(pending);
+
+		lock.unlock();
+		handle_batch(std::move(batch));
+		lock.lock();
+	}
+}
+
+request_scheduler::clock::time_point request_scheduler::now() const { return simulated ? sim_reply : clock::now(); }
+
+request_scheduler::clock::time_point request_scheduler::current() const {
+	return simulated ? sim_now : clock::now();
+}
+
+void request_scheduler::run() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		cv.wait(lock, [this] { return stop || !pending.empty(); });
+		if (stop) break;
+
+		// collect everything arriving within the window
+		cv.wait_for(lock, window, [this] { return stop; });
+		if (stop) break;
+
+		std::vector<cores_t> batch;
+		batch.swap(pending);
+
+		lock.unlock();
+		handle_batch(std::move(batch));
+		lock.lock();
+	}
+}
+
+void request_scheduler::handle_batch(std::vector<cores_t> batch) {
+	std::sort(batch.begin(), batch.end());
+	batch.erase(std::unique(batch.begin(), batch.end()), batch.end());
+
+	// answer from the cache if possible, e.g. results measured while the batch was collected
+	std::vector<cores_t> todo;
+	const auto start = current();
+	if (simulated) sim_reply = start;
+	for (auto &cores : batch) {
+		std::unique_lock<std::mutex> lock(cache_mutex);
+		const auto it = cache.find(cores);
+		if (it != cache.end() && start - it->second.time < ttl) {
+			const cache_entry hit = it->second;
+			lock.unlock();
+			reply(cores, hit.result, std::chrono::duration<double>(start - hit.time).count());
+		} else {
+			todo.push_back(std::move(cores));
+		}
+	}
+
+	// split the rest into rounds, within a round no two core sets share a NUMA node
+	while (!todo.empty()) {
+		std::set<size_t> used_nodes;
+		std::vector<cores_t> round, later;
+		for (auto &cores : todo) {
+			std::set<size_t> nodes;
+			for (auto c : cores) nodes.insert(node_of(c));
+
+			bool overlap = false;
+			for (auto n : nodes) overlap |= (used_nodes.count(n) != 0);
+
+			if (overlap) {
+				later.push_back(std::move(cores));
+			} else {
+				used_nodes.insert(nodes.begin(), nodes.end());
+				round.push_back(std::move(cores));
+			}
+		}
+
+		std::vector<measurement> results(round.size());
+		if (simulated) {
+			double duration = 0.0;
+			for (size_t i = 0; i < round.size(); ++i) {
+				results[i] = measure(round[i]);
+				duration = std::max(duration, results[i].duration);
+			}
+			sim_now += std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(duration));
+		} else {
+			std::vector<std::thread> threads;
+			for (size_t i = 1; i < round.size(); ++i) {
+				threads.emplace_back([this, &round, &results, i] { results[i] = measure(round[i]); });
+			}
+			results[0] = measure(round[0]);
+			for (auto &t : threads) t.join();
+		}
+
+		const auto done = current();
+		if (simulated) sim_reply = done;
+		{
+			std::lock_guard<std::mutex> lock(cache_mutex);
+			for (size_t i = 0; i < round.size(); ++i) cache[round[i]] = cache_entry{results[i], done};
+		}
+		for (size_t i = 0; i < round.size(); ++i) reply(round[i], results[i], 0.0);
+
+		todo.swap(later);
+	}
+
+	// forget expired entries, so the cache does not grow forever
+	const auto end = current();
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	for (auto it = cache.begin(); it != cache.end();) {
+		if (end - it->second.time >= ttl) {
+			it = cache.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
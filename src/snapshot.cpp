@@ -0,0 +1,128 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <cstdlib>
+
+#include "snapshot.hpp"
+
+[[noreturn]] static void print_help(const char *argv) {
+	std::cout << argv << " prints the results mmbwmon published and supports the following flags:\n";
+	std::cout << "\t --file \t Snapshot file of the agent. \t\t\t Default: " << snapshot_default_path << "\n";
+	std::cout << "\t --history \t Number of results printed. \t\t\t Default: 10\n";
+	std::cout << "\t --watch \t Print again every <ms>. \t\t\t Default: off\n";
+	std::cout << "\t --max-age \t Fail if the agent wrote nothing for <s>. \t Default: off\n";
+	exit(0);
+}
+
+static std::string path = snapshot_default_path;
+static size_t history = 10;
+static size_t watch_ms = 0;
+static double max_age = 0.0;
+
+static void parse_options(size_t argc, const char **argv) {
+	for (size_t i = 1; i < argc; ++i) {
+		std::string arg(argv[i]);
+
+		if (arg == "--file") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			path = std::string(argv[i + 1]);
+			++i;
+			continue;
+		}
+		if (arg == "--history") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			history = std::stoul(std::string(argv[i + 1]));
+			++i;
+			continue;
+		}
+		if (arg == "--watch") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			watch_ms = std::stoul(std::string(argv[i + 1]));
+			++i;
+			continue;
+		}
+		if (arg == "--max-age") {
+			if (i + 1 >= argc) {
+				print_help(argv[0]);
+			}
+			max_age = std::stod(std::string(argv[i + 1]));
+			++i;
+			continue;
+		}
+		print_help(argv[0]);
+	}
+}
+
+// seconds since time
+static double age(std::int64_t now, std::int64_t time) { return static_cast<double>(now - time) / 1e9; }
+
+// whether the agent runs and wrote something within max_age
+static bool is_live(const snapshot_data &d) {
+	return snapshot_agent_running(d) && (max_age <= 0.0 || age(snapshot_now(), d.updated) <= max_age);
+}
+
+static void print(const snapshot_data &d) {
+	const std::int64_t now = snapshot_now();
+	if (d.pid == 0)
+		std::cout << "The agent stopped, ";
+	else if (!snapshot_agent_running(d))
+		std::cout << "Agent " << d.pid << " is not running, ";
+	else
+		std::cout << "Agent " << d.pid << ", ";
+	std::cout << "updated " << age(now, d.updated) << " s ago\n";
+
+	std::cout << "Calibration (GByte/s for 1.." << d.calibration_size << " compact cores):";
+	for (size_t i = 0; i < d.calibration_size; ++i) std::cout << " " << d.calibration[i];
+	std::cout << "\n";
+
+	std::cout << "Node\tPeak\tConsumed\tResult\tAge\n";
+	for (size_t i = 0; i < d.node_count; ++i) {
+		const snapshot_node &n = d.nodes[i];
+		std::cout << n.id << "\t" << n.peak << "\t";
+		if (n.time == 0)
+			std::cout << "-\t\t-\t-\n";
+		else
+			std::cout << n.consumed << "\t\t" << n.result << "\t" << age(now, n.time) << "\n";
+	}
+
+	std::cout << "Age\tResult\tVariance\tDuration\tConsumed\tCores\n";
+	const auto results = snapshot_results(d);
+	for (size_t i = 0; i < std::min(history, results.size()); ++i) {
+		const snapshot_result &r = results[i];
+		std::cout << age(now, r.time) << "\t" << r.result << "\t" << r.variance << "\t\t" << r.duration << "\t\t"
+				  << r.consumed << "\t\t";
+		for (auto c : r.core_list()) std::cout << c << " ";
+		std::cout << "\n";
+	}
+	std::cout << std::flush;
+}
+
+int main(int argc, char const *argv[]) {
+	parse_options(static_cast<size_t>(argc), argv);
+
+	try {
+		const snapshot_reader reader(path);
+		while (true) {
+			const snapshot_data d = reader.read();
+			print(d);
+			if (watch_ms == 0) {
+				if (is_live(d)) break;
+				std::cerr << "The snapshot is stale" << std::endl;
+				return 1;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(watch_ms));
+			std::cout << "\n";
+		}
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,84 @@
+#include "snapshot_writer.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+snapshot_writer::snapshot_writer(const std::string &path) {
+	const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) throw std::runtime_error("Could not open " + path);
+	struct stat st;
+	// a file of another layout is grown, readers of it fail on the version
+	if (fstat(fd, &st) != 0 ||
+		(static_cast<size_t>(st.st_size) < sizeof(snapshot_file) && ftruncate(fd, sizeof(snapshot_file)) != 0)) {
+		close(fd);
+		throw std::runtime_error("Could not resize " + path);
+	}
+	void *p = mmap(nullptr, sizeof(snapshot_file), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) throw std::runtime_error("Could not map " + path);
+	file = static_cast<snapshot_file *>(p);
+	if (!file->seq.is_lock_free()) throw std::runtime_error("The snapshot needs lock-free 64 bit atomics");
+
+	// a file of a killed agent is taken over, the readers of a running one would see two writers
+	const std::uint64_t owner = file->data.pid;
+	if (file->magic == snapshot_magic && file->version == snapshot_version &&
+		owner != static_cast<std::uint64_t>(getpid()) && snapshot_agent_running(file->data)) {
+		munmap(p, sizeof(snapshot_file));
+		throw std::runtime_error(path + " is used by the running agent " + std::to_string(owner));
+	}
+
+	update([](snapshot_data &d) {
+		std::memset(&d, 0, sizeof(d));
+		d.pid = static_cast<std::uint64_t>(getpid());
+	});
+	file->magic = snapshot_magic;
+	file->version = snapshot_version;
+	file->size = sizeof(snapshot_file);
+}
+
+snapshot_writer::~snapshot_writer() {
+	update([](snapshot_data &d) { d.pid = 0; });
+	munmap(file, sizeof(snapshot_file));
+}
+
+template <class F> void snapshot_writer::update(F f) {
+	std::lock_guard<std::mutex> lock(mutex);
+	// a crashed writer may have left seq odd
+	const std::uint64_t seq = file->seq.load(std::memory_order_relaxed) | 1;
+	file->seq.store(seq, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	f(file->data);
+	file->data.updated = snapshot_now();
+	file->seq.store(seq + 1, std::memory_order_release);
+}
+
+void snapshot_writer::set_calibration(const std::vector<double> &membw, const std::map<size_t, double> &peaks) {
+	update([&](snapshot_data &d) {
+		d.calibration_size = std::min(membw.size(), snapshot_max_cores);
+		std::copy(membw.begin(), membw.begin() + static_cast<std::ptrdiff_t>(d.calibration_size), d.calibration);
+		d.node_count = 0;
+		for (const auto &p : peaks) {
+			if (d.node_count == snapshot_max_nodes) break;
+			d.nodes[d.node_count++] = snapshot_node{p.first, p.second, 0.0, 0.0, 0};
+		}
+	});
+}
+
+void snapshot_writer::add_result(const std::vector<size_t> &cores, const std::vector<size_t> &nodes, double result,
+								 double variance, double duration, double consumed) {
+	const std::int64_t now = snapshot_now();
+	update([&](snapshot_data &d) {
+		snapshot_result &r = d.history[d.results++ % snapshot_history];
+		r = snapshot_result{now, result, variance, duration, consumed, {}};
+		for (auto c : cores)
+			if (c < snapshot_max_cores) r.cores[c / 64] |= std::uint64_t(1) << (c % 64);
+
+		if (nodes.size() != 1) return;
+		for (std::uint64_t i = 0; i < d.node_count; ++i) {
+			if (d.nodes[i].id != nodes[0]) continue;
+			d.nodes[i].consumed = consumed;
+			d.nodes[i].result = result;
+			d.nodes[i].time = now;
+		}
+	});
+}
@@ -0,0 +1,107 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+// "mmbwtrc" and the version of the format
+static const char trace_magic[8] = {'m', 'm', 'b', 'w', 't', 'r', 'c', '1'};
+
+template <class T> static void put(std::string &buf, const T &value) {
+	buf.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <class T> static bool get(std::istream &in, T &value) {
+	return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof(value)));
+}
+
+trace_writer::trace_writer(const std::string &path, const trace_header &header)
+	: out(path, std::ios::binary | std::ios::trunc), start(std::chrono::steady_clock::now()) {
+	std::string buf(trace_magic, sizeof(trace_magic));
+	put(buf, header.window_ms);
+	put(buf, header.ttl_ms);
+	put(buf, static_cast<std::uint32_t>(header.nodes.size()));
+	for (auto n : header.nodes) put(buf, n);
+	out.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+	out.flush();
+	if (!out) throw std::runtime_error("Could not write " + path);
+}
+
+std::uint64_t trace_writer::elapsed() const {
+	return static_cast<std::uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+void trace_writer::message(const std::string &payload) {
+	trace_record r{trace_record::message, elapsed(), payload, {}, {}, 0.0};
+	write(r);
+}
+
+void trace_writer::measurement(const request_scheduler::cores_t &cores, const request_scheduler::measurement &result) {
+	trace_record r{trace_record::measurement, elapsed(), "", cores, result, 0.0};
+	write(r);
+}
+
+void trace_writer::reply(const request_scheduler::cores_t &cores, const request_scheduler::measurement &result,
+						 double age) {
+	trace_record r{trace_record::reply, elapsed(), "", cores, result, age};
+	write(r);
+}
+
+void trace_writer::write(const trace_record &record) {
+	// kind, time, then the payload or the cores and the result
+	std::string buf;
+	put(buf, record.kind);
+	put(buf, record.time_ns);
+	if (record.kind == trace_record::message) {
+		put(buf, static_cast<std::uint32_t>(record.payload.size()));
+		buf += record.payload;
+	} else {
+		put(buf, static_cast<std::uint32_t>(record.cores.size()));
+		for (auto c : record.cores) put(buf, static_cast<std::uint32_t>(c));
+		put(buf, record.result.result);
+		put(buf, record.result.variance);
+		put(buf, record.result.duration);
+		put(buf, record.result.consumed);
+		if (record.kind == trace_record::reply) put(buf, record.age);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	out.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+	out.flush();
+}
+
+trace_reader::trace_reader(const std::string &path) : in(path, std::ios::binary) {
+	char magic[sizeof(trace_magic)];
+	std::uint32_t count = 0;
+	if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), trace_magic) ||
+		!get(in, head.window_ms) || !get(in, head.ttl_ms) || !get(in, count))
+		throw std::runtime_error(path + " is not a trace");
+	head.nodes.resize(count);
+	for (auto &n : head.nodes)
+		if (!get(in, n)) throw std::runtime_error(path + " is not a trace");
+}
+
+bool trace_reader::next(trace_record &record) {
+	if (!get(in, record.kind)) return false;
+
+	std::uint32_t size = 0;
+	bool ok = get(in, record.time_ns) && get(in, size);
+	if (ok && record.kind == trace_record::message) {
+		record.payload.resize(size);
+		ok = static_cast<bool>(in.read(&record.payload[0], size));
+	} else if (ok && (record.kind == trace_record::measurement || record.kind == trace_record::reply)) {
+		record.cores.resize(size);
+		for (auto &c : record.cores) {
+			std::uint32_t core = 0;
+			ok = ok && get(in, core);
+			c = core;
+		}
+		ok = ok && get(in, record.result.result) && get(in, record.result.variance) &&
+			 get(in, record.result.duration) && get(in, record.result.consumed);
+		if (record.kind == trace_record::reply) ok = ok && get(in, record.age);
+	} else if (ok) {
+		throw std::runtime_error("Unknown trace record " + std::to_string(record.kind));
+	}
+	if (!ok) throw std::runtime_error("Truncated trace record");
+	return true;
+}
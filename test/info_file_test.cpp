@@ -0,0 +1,87 @@
+#include <fructose/fructose.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "info_file.hpp"
+
+using fast::msg::agent::mmbwmon::system_info;
+
+// written by a version without buffer placement and curves
+static const char legacy_info[] = "threads: 2\nsmt: 1\nnuma: 1\nbandwidth: [10.5, 12.5]\n";
+
+struct Info_file_tester : public fructose::test_base<Info_file_tester> {
+	const distgend_initT init{2, 1, 1};
+	const distgend_placementT placement{4096, 1.0, 0};
+
+	void legacy_file_matches(const std::string &test_name) {
+		(void)test_name;
+		system_info info;
+		info.from_string(legacy_info);
+		fructose_assert_eq(0, info.page_size);
+		fructose_assert_eq(0, info.buffer_size);
+		fructose_assert(info_matches(info, init, 1 << 20, placement));
+		fructose_assert(!info_matches(info, distgend_initT{2, 1, 2}, 1 << 20, placement));
+	}
+
+	void settings_are_compared(const std::string &test_name) {
+		(void)test_name;
+		const system_info info(2, 1, 1, {10.5, 12.5}, 4096, 1.0, 1 << 20);
+		system_info read;
+		read.from_string(info.to_string());
+		fructose_assert(info_matches(read, init, 1 << 20, placement));
+		fructose_assert(!info_matches(read, init, 2 << 20, placement));
+		fructose_assert(!info_matches(read, init, 1 << 20, distgend_placementT{2 << 20, 1.0, 0}));
+		fructose_assert(!info_matches(read, init, 1 << 20, distgend_placementT{4096, 0.5, 0}));
+		fructose_assert(!info_matches(read, init, 1 << 20, distgend_placementT{4096, -1.0, 0}));
+	}
+
+	void legacy_file_is_restored(const std::string &test_name) {
+		(void)test_name;
+		// two cores of one node, nothing is measured
+		char tmp[] = "/tmp/mmbwmon_info_test.XXXXXX";
+		const std::string root = mkdtemp(tmp);
+		const std::string cpus = root + "/devices/system/cpu";
+		std::system(("mkdir -p " + cpus + "/cpu0/topology " + cpus + "/cpu1/topology").c_str());
+		std::ofstream(cpus + "/online") << "0-1\n";
+		for (int c = 0; c < 2; ++c) {
+			std::ofstream(cpus + "/cpu" + std::to_string(c) + "/topology/physical_package_id") << "0\n";
+			std::ofstream(cpus + "/cpu" + std::to_string(c) + "/topology/thread_siblings_list") << c << "\n";
+		}
+		setenv("DISTGEN_SYSFS", root.c_str(), 1);
+		distgend_initT detected;
+		fructose_assert_eq(0, distgend_detect_topology(&detected));
+		std::system(("rm -rf " + root).c_str());
+		fructose_assert(detected.number_of_threads == 2 && detected.NUMA_domains == 1 && detected.SMT_factor == 1);
+
+		distgend_set_buffer_size(1 << 20);
+		distgend_init_uncalibrated(detected);
+		system_info info;
+		info.from_string(legacy_info);
+		fructose_assert(info_matches(info, detected, distgend_get_buffer_size(), distgend_get_placement()));
+		fructose_assert(restore_legacy_info(info, detected));
+		fructose_assert_double_eq(10.5, distgend_get_measured_idle_bandwidth(1));
+		fructose_assert_double_eq(12.5, distgend_get_measured_idle_bandwidth(2));
+		const size_t both[] = {0, 1};
+		fructose_assert_double_eq(12.5, distgend_get_max_bandwidth_set(distgend_cpusetT{2, both}));
+
+		// other topologies and files with curves are not restored this way
+		info.threads = 4;
+		fructose_assert(!restore_legacy_info(info, detected));
+		info.threads = 2;
+		info.curves[0]["compact"] = {1.0, 2.0};
+		fructose_assert(!restore_legacy_info(info, detected));
+	}
+};
+
+int main(int argc, char **argv) {
+	Info_file_tester tests;
+	tests.add_test("legacy-file-matches", &Info_file_tester::legacy_file_matches);
+	tests.add_test("settings-are-compared", &Info_file_tester::settings_are_compared);
+	tests.add_test("legacy-file-is-restored", &Info_file_tester::legacy_file_is_restored);
+	return tests.run(argc, argv);
+}
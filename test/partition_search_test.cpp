@@ -0,0 +1,143 @@
+#include <fructose/fructose.h>
+
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "partition_search.hpp"
+
+using ways_t = partition_search::ways_t;
+// the throughput of an application with ways
+using curve_t = std::function<double(size_t ways)>;
+
+// every allocation giving each of apps at least min_ways, at most total_ways together
+static void allocations(size_t apps, size_t total_ways, size_t min_ways, ways_t &current,
+						std::vector<ways_t> &res) {
+	if (current.size() == apps) {
+		res.push_back(current);
+		return;
+	}
+	const size_t used = std::accumulate(current.begin(), current.end(), size_t(0));
+	for (size_t w = min_ways; used + w + (apps - current.size() - 1) * min_ways <= total_ways; ++w) {
+		current.push_back(w);
+		allocations(apps, total_ways, min_ways, current, res);
+		current.pop_back();
+	}
+}
+
+struct Partition_search_tester : public fructose::test_base<Partition_search_tester> {
+	std::vector<ways_t> measured;
+
+	// the applications run with the synthetic curves, every allocation measured is recorded
+	partition_search::measure_fn measure(const std::vector<curve_t> &curves) {
+		return [this, curves](const ways_t &ways) {
+			measured.push_back(ways);
+			std::vector<double> res;
+			for (size_t a = 0; a < curves.size(); ++a) res.push_back(curves[a](ways[a]));
+			return res;
+		};
+	}
+
+	// the best weighted throughput of all allocations, relative to the throughput with the most ways
+	static double brute_force(const std::vector<curve_t> &curves, const std::vector<double> &weights,
+							  size_t total_ways, size_t min_ways) {
+		std::vector<ways_t> all;
+		ways_t current;
+		allocations(curves.size(), total_ways, min_ways, current, all);
+		const size_t max_ways = total_ways - (curves.size() - 1) * min_ways;
+		double best = 0.0;
+		for (const auto &ways : all) {
+			double v = 0.0;
+			for (size_t a = 0; a < curves.size(); ++a) v += weights[a] * curves[a](ways[a]) / curves[a](max_ways);
+			best = std::max(best, v);
+		}
+		return best;
+	}
+
+	void setup() { measured.clear(); }
+
+	void finds_best_partition(const std::string &test_name) {
+		(void)test_name;
+		// a cache friendly application that needs 6 ways, a streaming one and one that saturates at 3 ways
+		const std::vector<curve_t> curves = {
+			[](size_t w) { return 1.0 + static_cast<double>(std::min<size_t>(w, 6)); },
+			[](size_t w) { return 5.0 + 0.01 * static_cast<double>(w); },
+			[](size_t w) { return 2.0 * static_cast<double>(std::min<size_t>(w, 3)); },
+		};
+		const std::vector<double> weights = {1.0, 1.0, 2.0};
+		partition_search search(measure(curves), weights, 12, 1, 0.01);
+		const ways_t best = search.run();
+
+		// the streaming application gains less than the tolerance from the 2 ways left
+		fructose_assert(best == ways_t({6, 1, 3}));
+		std::vector<double> throughput;
+		for (size_t a = 0; a < curves.size(); ++a) throughput.push_back(curves[a](best[a]));
+		const double optimum = brute_force(curves, weights, 12, 1);
+		fructose_assert(search.weighted_throughput(throughput) <= optimum);
+		fructose_assert(optimum - search.weighted_throughput(throughput) <= 0.01 * weights[1]);
+		fructose_assert_double_eq(search.weighted_throughput(throughput), search.predicted_weighted_throughput(best));
+		// the curves are not measured everywhere
+		std::vector<ways_t> all;
+		ways_t current;
+		allocations(3, 12, 1, current, all);
+		fructose_assert(search.measurements() < all.size());
+	}
+
+	void prunes_dominated_ways(const std::string &test_name) {
+		(void)test_name;
+		// both saturate, more ways gain nothing: the rest of the cache stays unallocated
+		const std::vector<curve_t> curves = {
+			[](size_t w) { return static_cast<double>(std::min<size_t>(w, 4)); },
+			[](size_t w) { return 3.0 * static_cast<double>(std::min<size_t>(w, 2)); },
+		};
+		const std::vector<double> weights = {1.0, 1.0};
+		partition_search search(measure(curves), weights, 16, 1, 0.05);
+		const ways_t best = search.run();
+		fructose_assert(best == ways_t({4, 2}));
+		fructose_assert_double_eq(brute_force(curves, weights, 16, 1), search.predicted_weighted_throughput(best));
+
+		// gains below the tolerance are dominated as well, the result keeps the fewest ways
+		const std::vector<curve_t> flat = {
+			[](size_t w) { return 10.0 + 0.01 * static_cast<double>(w); },
+			[](size_t w) { return static_cast<double>(std::min<size_t>(w, 8)); },
+		};
+		partition_search coarse(measure(flat), weights, 16, 1, 0.05);
+		fructose_assert(coarse.run() == ways_t({1, 8}));
+	}
+
+	void respects_limits(const std::string &test_name) {
+		(void)test_name;
+		const std::vector<curve_t> curves = {
+			[](size_t w) { return static_cast<double>(w); },
+			[](size_t w) { return 2.0 * static_cast<double>(w); },
+			[](size_t w) { return 0.5 * static_cast<double>(w); },
+		};
+		partition_search search(measure(curves), {1.0, 1.0, 1.0}, 11, 3, 0.01);
+		const ways_t best = search.run();
+		fructose_assert_eq(3, best.size());
+		fructose_assert(std::accumulate(best.begin(), best.end(), size_t(0)) <= 11);
+		for (auto w : best) fructose_assert(w >= 3);
+		// every allocation measured fits the cache and gives every application min_ways
+		for (const auto &ways : measured) {
+			fructose_assert(std::accumulate(ways.begin(), ways.end(), size_t(0)) <= 11);
+			for (auto w : ways) fructose_assert(w >= 3);
+		}
+		fructose_assert(search.equal_split() == ways_t({4, 4, 3}));
+
+		// the default group keeps a CLOSID
+		fructose_assert(partition_search::can_partition(3, 11, 3, 4));
+		fructose_assert(!partition_search::can_partition(4, 11, 2, 4));
+		fructose_assert(!partition_search::can_partition(4, 11, 3, 16));
+		fructose_assert(!partition_search::can_partition(0, 11, 1, 16));
+	}
+};
+
+int main(int argc, char **argv) {
+	Partition_search_tester tests;
+	tests.add_test("finds-best-partition", &Partition_search_tester::finds_best_partition);
+	tests.add_test("prunes-dominated-ways", &Partition_search_tester::prunes_dominated_ways);
+	tests.add_test("respects-limits", &Partition_search_tester::respects_limits);
+	return tests.run(argc, argv);
+}
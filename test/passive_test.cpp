@@ -0,0 +1,162 @@
+#include <fructose/fructose.h>
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include "passive.hpp"
+
+// the bytes of a GByte, the unit of passive_monitor::bandwidth()
+static const std::uint64_t gbyte = 1024ull * 1024 * 1024;
+
+// fails on every read
+class failing_source : public bandwidth_source {
+public:
+	std::map<size_t, std::uint64_t> read_bytes() override { throw std::runtime_error("counters unavailable"); }
+	std::string name() const override { return "failing"; }
+};
+
+// counts up by a fixed number of bytes per read, the first reads fail
+class counting_source : public bandwidth_source {
+public:
+	explicit counting_source(int failures) : failures(failures) {}
+
+	std::map<size_t, std::uint64_t> read_bytes() override {
+		if (failures-- > 0) throw std::runtime_error("not yet");
+		bytes += gbyte;
+		return {{0, bytes}};
+	}
+	std::string name() const override { return "counting"; }
+
+private:
+	int failures;
+	std::uint64_t bytes = 0;
+};
+
+struct Passive_tester : public fructose::test_base<Passive_tester> {
+	std::string dir;
+
+	// every test gets an empty directory of counters
+	void setup() {
+		char tmp[] = "/tmp/mmbwmon_passive_test.XXXXXX";
+		dir = mkdtemp(tmp);
+	}
+
+	void teardown() { std::system(("rm -rf " + dir).c_str()); }
+
+	void write_counter(size_t node, std::uint64_t bytes) {
+		std::ofstream(dir + "/node" + std::to_string(node)) << bytes << "\n";
+	}
+
+	void file_source(const std::string &test_name) {
+		(void)test_name;
+		write_counter(0, 0);
+		write_counter(1, 0);
+		const auto source = make_bandwidth_source("file:" + dir, {});
+		fructose_assert_eq("file:" + dir, source->name());
+		const auto first = source->read_bytes();
+		fructose_assert_eq(2, first.size());
+
+		write_counter(0, 3 * gbyte);
+		write_counter(1, 5);
+		const auto second = source->read_bytes();
+		fructose_assert_eq(3 * gbyte, second.at(0));
+		fructose_assert_eq(5, second.at(1));
+	}
+
+	// two L3 domains on two nodes, counted by the root group and one control group
+	void mbm_source(const std::string &test_name) {
+		(void)test_name;
+		for (size_t cpu = 0; cpu < 4; ++cpu) {
+			const std::string cache = dir + "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index3";
+			std::system(("mkdir -p " + cache).c_str());
+			std::ofstream(cache + "/id") << cpu / 2 << "\n";
+		}
+		const std::string resctrl = dir + "/resctrl";
+		// mon_L3_05 belongs to CPUs the agent does not use, info is no group
+		for (const std::string group : {"", "/grp", "/info"}) {
+			for (const std::string domain : {"00", "01", "05"}) {
+				const std::string mon = resctrl + group + "/mon_data/mon_L3_" + domain;
+				std::system(("mkdir -p " + mon).c_str());
+				std::ofstream(mon + "/mbm_total_bytes") << (group == "/grp" ? 100 : 1) * (std::stoul(domain) + 1)
+														<< "\n";
+			}
+		}
+		setenv("MMBWMON_SYSFS", (dir + "/sys").c_str(), 1);
+		setenv("PONRI_PATH", resctrl.c_str(), 1);
+
+		const auto source = make_bandwidth_source("mbm", {{0, 0}, {1, 0}, {2, 1}, {3, 1}});
+		unsetenv("MMBWMON_SYSFS");
+		unsetenv("PONRI_PATH");
+		fructose_assert_eq("mbm", source->name());
+		const auto bytes = source->read_bytes();
+		fructose_assert_eq(2, bytes.size());
+		fructose_assert_eq(101, bytes.at(0));
+		fructose_assert_eq(202, bytes.at(1));
+	}
+
+	void empty_file_source(const std::string &test_name) {
+		(void)test_name;
+		fructose_assert_exception(make_bandwidth_source("file:" + dir, {}), std::runtime_error);
+		fructose_assert_exception(make_bandwidth_source("nonsense", {}), std::runtime_error);
+	}
+
+	void monitor_file_source(const std::string &test_name) {
+		(void)test_name;
+		write_counter(0, 0);
+		passive_monitor monitor(make_bandwidth_source("file:" + dir, {}), std::chrono::milliseconds(100), 1);
+		// give the monitor time for its first read, then about 10 GByte/s on node 0
+		std::this_thread::sleep_for(std::chrono::milliseconds(30));
+		write_counter(0, gbyte);
+		monitor.wait_for_sample(std::chrono::seconds(5));
+		const auto bw = monitor.bandwidth();
+		fructose_assert_eq(1, bw.size());
+		fructose_assert(bw.at(0) > 2.0 && bw.at(0) <= 10.5);
+	}
+
+	void failing_source_times_out(const std::string &test_name) {
+		(void)test_name;
+		passive_monitor monitor(std::unique_ptr<bandwidth_source>(new failing_source),
+								std::chrono::milliseconds(10), 1);
+		const auto start = std::chrono::steady_clock::now();
+		try {
+			monitor.wait_for_sample(std::chrono::milliseconds(200));
+			fructose_fail("wait_for_sample() did not throw");
+		} catch (const std::runtime_error &e) {
+			fructose_assert(std::string(e.what()).find("counters unavailable") != std::string::npos);
+		}
+		fructose_assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+		fructose_assert(monitor.bandwidth().empty());
+	}
+
+	void recovers_from_failed_reads(const std::string &test_name) {
+		(void)test_name;
+		passive_monitor monitor(std::unique_ptr<bandwidth_source>(new counting_source(3)),
+								std::chrono::milliseconds(10), 4);
+		monitor.wait_for_sample(std::chrono::seconds(5));
+		// the first successful read only gives the baseline, so every sample has node 0
+		const auto bw = monitor.bandwidth();
+		fructose_assert_eq(1, bw.size());
+		fructose_assert(bw.at(0) > 0.0);
+	}
+};
+
+int main(int argc, char **argv) {
+	Passive_tester tests;
+	tests.add_test("file-source", &Passive_tester::file_source);
+	tests.add_test("mbm-source", &Passive_tester::mbm_source);
+	tests.add_test("empty-file-source", &Passive_tester::empty_file_source);
+	tests.add_test("monitor-file-source", &Passive_tester::monitor_file_source);
+	tests.add_test("failing-source-times-out", &Passive_tester::failing_source_times_out);
+	tests.add_test("recovers-from-failed-reads", &Passive_tester::recovers_from_failed_reads);
+	return tests.run(argc, argv);
+}
@@ -0,0 +1,196 @@
+#include <fructose/fructose.h>
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "perf_counters.hpp"
+
+// some work for the counters
+static double spin(size_t n) {
+	volatile double x = 0.0;
+	for (size_t i = 0; i < n; ++i) x = x + static_cast<double>(i);
+	return x;
+}
+
+struct Perf_counters_tester : public fructose::test_base<Perf_counters_tester> {
+	std::string root;
+
+	void write_file(const std::string &path, const std::string &content) { std::ofstream(root + path) << content; }
+	void make_dir(const std::string &path) { mkdir((root + path).c_str(), S_IRWXU); }
+
+	// a fake sysfs tree with the PMU "fake", passed with MMBWMON_SYSFS
+	void setup() {
+		char tmp[] = "/tmp/mmbwmon_perf_test.XXXXXX";
+		root = mkdtemp(tmp);
+		for (const char *dir : {"/bus", "/bus/event_source", "/bus/event_source/devices",
+								"/bus/event_source/devices/fake", "/bus/event_source/devices/fake/format",
+								"/bus/event_source/devices/fake/events"})
+			make_dir(dir);
+		const std::string pmu = "/bus/event_source/devices/fake/";
+		write_file(pmu + "type", "42\n");
+		write_file(pmu + "cpumask", "0-1,4\n");
+		write_file(pmu + "format/event", "config:0-7\n");
+		write_file(pmu + "format/umask", "config:8-15\n");
+		write_file(pmu + "format/edge", "config:18\n");
+		// split over two bit ranges of another field
+		write_file(pmu + "format/split", "config1:0-3,32-35\n");
+		write_file(pmu + "format/weird", "perf:0-3\n");
+		write_file(pmu + "events/cas_count_read", "event=0x04,umask=0x03\n");
+		write_file(pmu + "events/cas_count_read.scale", "6.103515625e-5\n");
+		write_file(pmu + "events/cas_count_read.unit", "MiB\n");
+		write_file(pmu + "events/plain", "event=0x2e,umask=0x41\n");
+		write_file(pmu + "events/broken", "nonsense=1\n");
+		setenv("MMBWMON_SYSFS", root.c_str(), 1);
+	}
+
+	void teardown() {
+		unsetenv("MMBWMON_SYSFS");
+		std::system(("rm -rf " + root).c_str());
+	}
+
+	// software events, which exist without a PMU. nullptr if perf_event_open is not allowed.
+	std::unique_ptr<perf_self_counters> open_self() {
+		try {
+			return std::unique_ptr<perf_self_counters>(new perf_self_counters({"task-clock", "page-faults"}));
+		} catch (const std::runtime_error &e) {
+			std::cout << "Skipping, perf events are not available: " << e.what() << std::endl;
+			return nullptr;
+		}
+	}
+
+	void self_counters(const std::string &test_name) {
+		(void)test_name;
+		const auto counters = open_self();
+		if (!counters) return;
+
+		const std::vector<double> first = counters->read();
+		fructose_assert_eq(2, first.size());
+		spin(10000000);
+		const std::vector<double> second = counters->read();
+		fructose_assert_eq(2, second.size());
+		// task-clock counts ns
+		fructose_assert(second[0] > first[0]);
+		fructose_assert(second[1] >= first[1]);
+		// software events are not on the PMU
+		fructose_assert(!counters->used_rdpmc());
+	}
+
+	void generic_events(const std::string &test_name) {
+		(void)test_name;
+		const perf_event_desc instructions = perf_event_from_name("instructions");
+		fructose_assert_eq(PERF_TYPE_HARDWARE, instructions.attr.type);
+		fructose_assert_eq(PERF_COUNT_HW_INSTRUCTIONS, instructions.attr.config);
+		fructose_assert_eq(0, instructions.attr.exclude_kernel);
+		fructose_assert(instructions.cpus.empty());
+
+		const perf_event_desc clock = perf_event_from_name("task-clock");
+		fructose_assert_eq(PERF_TYPE_SOFTWARE, clock.attr.type);
+		fructose_assert_eq(PERF_COUNT_SW_TASK_CLOCK, clock.attr.config);
+
+		fructose_assert_exception(perf_event_from_name("no-such-event"), std::runtime_error);
+	}
+
+	void modifiers(const std::string &test_name) {
+		(void)test_name;
+		const perf_event_desc user = perf_event_from_name("cycles:u");
+		fructose_assert_eq(PERF_COUNT_HW_CPU_CYCLES, user.attr.config);
+		fructose_assert_eq(1, user.attr.exclude_kernel);
+		fructose_assert_eq(1, user.attr.exclude_hv);
+		fructose_assert_eq(0, user.attr.exclude_user);
+
+		const perf_event_desc kernel = perf_event_from_name("cycles:k");
+		fructose_assert_eq(0, kernel.attr.exclude_kernel);
+		fructose_assert_eq(1, kernel.attr.exclude_user);
+
+		// after the PMU event as well
+		const perf_event_desc pmu = perf_event_from_name("fake/plain/:u");
+		fructose_assert_eq(42, pmu.attr.type);
+		fructose_assert_eq(1, pmu.attr.exclude_kernel);
+
+		fructose_assert_exception(perf_event_from_name("cycles:x"), std::runtime_error);
+	}
+
+	void sysfs_events(const std::string &test_name) {
+		(void)test_name;
+		const perf_event_desc cas = perf_event_from_name("fake/cas_count_read/");
+		fructose_assert_eq(42, cas.attr.type);
+		fructose_assert_eq(0x0304, cas.attr.config);
+		fructose_assert_double_eq(6.103515625e-5, cas.scale);
+		fructose_assert_eq("MiB", cas.unit);
+		// the cpumask of the PMU
+		fructose_assert(cas.cpus == std::vector<size_t>({0, 1, 4}));
+		// one count is a cache line
+		fructose_assert_double_eq(64.0, perf_event_bytes(cas));
+
+		const perf_event_desc plain = perf_event_from_name("fake/plain/");
+		fructose_assert_eq(0x412e, plain.attr.config);
+		fructose_assert_double_eq(1.0, plain.scale);
+		fructose_assert(plain.unit.empty());
+		fructose_assert_double_eq(0.0, perf_event_bytes(plain));
+
+		fructose_assert_exception(perf_event_from_name("fake/missing/"), std::runtime_error);
+		fructose_assert_exception(perf_event_from_name("fake/broken/"), std::runtime_error);
+		fructose_assert_exception(perf_event_from_name("nopmu/plain/"), std::runtime_error);
+	}
+
+	void format_terms(const std::string &test_name) {
+		(void)test_name;
+		const perf_event_desc terms = perf_event_from_name("fake/event=0x2e,umask=65/");
+		fructose_assert_eq(0x412e, terms.attr.config);
+
+		// a term without a value sets its bits to 1
+		const perf_event_desc flag = perf_event_from_name("fake/event=1,edge/");
+		fructose_assert_eq(1ull | 1ull << 18, flag.attr.config);
+
+		// the low bits of the value fill the first range, the next ones the second
+		const perf_event_desc split = perf_event_from_name("fake/split=0xab/");
+		fructose_assert_eq(0xa0000000bull, split.attr.config1);
+		fructose_assert_eq(0, split.attr.config);
+		// bits beyond the ranges are dropped
+		fructose_assert_eq(0xf0000000full, perf_event_from_name("fake/split=0xfff/").attr.config1);
+
+		fructose_assert_exception(perf_event_from_name("fake/weird=1/"), std::runtime_error);
+		fructose_assert_exception(perf_event_from_name("fake/nonsense=1/"), std::runtime_error);
+		fructose_assert_exception(perf_event_from_name("fake/event=1"), std::runtime_error);
+		fructose_assert_exception(perf_event_from_name("fake//"), std::runtime_error);
+	}
+
+	void cpulists(const std::string &test_name) {
+		(void)test_name;
+		const std::string mask = "/bus/event_source/devices/fake/cpumask";
+		write_file(mask, "3\n");
+		fructose_assert(perf_event_from_name("fake/plain/").cpus == std::vector<size_t>({3}));
+		write_file(mask, "0-2,8,10-11\n");
+		fructose_assert(perf_event_from_name("fake/plain/").cpus == std::vector<size_t>({0, 1, 2, 8, 10, 11}));
+		// core PMUs have no cpumask and count on every CPU
+		write_file(mask, "");
+		fructose_assert(perf_event_from_name("fake/plain/").cpus.empty());
+	}
+
+	void self_counters_errors(const std::string &test_name) {
+		(void)test_name;
+		fructose_assert_exception(perf_self_counters({}), std::runtime_error);
+		fructose_assert_exception(perf_self_counters({"no-such-event"}), std::runtime_error);
+	}
+};
+
+int main(int argc, char **argv) {
+	Perf_counters_tester tests;
+	tests.add_test("generic-events", &Perf_counters_tester::generic_events);
+	tests.add_test("modifiers", &Perf_counters_tester::modifiers);
+	tests.add_test("sysfs-events", &Perf_counters_tester::sysfs_events);
+	tests.add_test("format-terms", &Perf_counters_tester::format_terms);
+	tests.add_test("cpulists", &Perf_counters_tester::cpulists);
+	tests.add_test("self-counters", &Perf_counters_tester::self_counters);
+	tests.add_test("self-counters-errors", &Perf_counters_tester::self_counters_errors);
+	return tests.run(argc, argv);
+}
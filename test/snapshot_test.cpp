@@ -0,0 +1,97 @@
+#include <fructose/fructose.h>
+
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "snapshot.hpp"
+#include "snapshot_writer.hpp"
+
+// a pid no process has, of a child that already exited
+static pid_t dead_pid() {
+	const pid_t pid = fork();
+	if (pid == 0) _exit(0);
+	waitpid(pid, nullptr, 0);
+	return pid;
+}
+
+struct Snapshot_tester : public fructose::test_base<Snapshot_tester> {
+	std::string dir;
+	std::string path;
+
+	void setup() {
+		char tmp[] = "/tmp/mmbwmon_snapshot_test.XXXXXX";
+		dir = mkdtemp(tmp);
+		path = dir + "/snapshot";
+	}
+
+	void teardown() { std::system(("rm -rf " + dir).c_str()); }
+
+	// pretends the file was written by the agent pid
+	void set_pid(std::uint64_t pid) {
+		const int fd = open(path.c_str(), O_RDWR);
+		void *p = mmap(nullptr, sizeof(snapshot_file), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		static_cast<snapshot_file *>(p)->data.pid = pid;
+		munmap(p, sizeof(snapshot_file));
+	}
+
+	void write_and_read(const std::string &test_name) {
+		(void)test_name;
+		snapshot_writer writer(path);
+		writer.set_calibration({10.0, 20.0}, {{0, 20.0}});
+		writer.add_result({0, 65}, {0}, 0.5, 0.01, 0.1, 10.0);
+
+		const snapshot_data d = snapshot_reader(path).read();
+		fructose_assert_eq(static_cast<std::uint64_t>(getpid()), d.pid);
+		fructose_assert(snapshot_agent_running(d));
+		fructose_assert_eq(2, d.calibration_size);
+		fructose_assert_eq(1, d.results);
+		fructose_assert(d.history[0].core_list() == std::vector<size_t>({0, 65}));
+		fructose_assert_eq(10.0, d.nodes[0].consumed);
+	}
+
+	void stopped_agent(const std::string &test_name) {
+		(void)test_name;
+		{ snapshot_writer writer(path); }
+		const snapshot_reader reader(path);
+		fructose_assert_eq(0, reader.read().pid);
+		fructose_assert(!snapshot_agent_running(reader.read()));
+	}
+
+	void killed_agent(const std::string &test_name) {
+		(void)test_name;
+		{ snapshot_writer writer(path); }
+		const pid_t dead = dead_pid();
+		set_pid(static_cast<std::uint64_t>(dead));
+		fructose_assert(!snapshot_agent_running(snapshot_reader(path).read()));
+
+		// the file of the killed agent is taken over
+		snapshot_writer writer(path);
+		fructose_assert_eq(static_cast<std::uint64_t>(getpid()), snapshot_reader(path).read().pid);
+	}
+
+	void running_agent(const std::string &test_name) {
+		(void)test_name;
+		{ snapshot_writer writer(path); }
+		// the parent runs as long as the test does
+		set_pid(static_cast<std::uint64_t>(getppid()));
+		fructose_assert(snapshot_agent_running(snapshot_reader(path).read()));
+		fructose_assert_exception(snapshot_writer{path}, std::runtime_error);
+		fructose_assert_eq(static_cast<std::uint64_t>(getppid()), snapshot_reader(path).read().pid);
+	}
+};
+
+int main(int argc, char **argv) {
+	Snapshot_tester tests;
+	tests.add_test("write-and-read", &Snapshot_tester::write_and_read);
+	tests.add_test("stopped-agent", &Snapshot_tester::stopped_agent);
+	tests.add_test("killed-agent", &Snapshot_tester::killed_agent);
+	tests.add_test("running-agent", &Snapshot_tester::running_agent);
+	return tests.run(argc, argv);
+}
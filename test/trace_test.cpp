@@ -0,0 +1,135 @@
+#include <fructose/fructose.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <fast-lib/message/agent/mmbwmon/request.hpp>
+
+#include "request_scheduler.hpp"
+#include "trace.hpp"
+
+using cores_t = request_scheduler::cores_t;
+using sched_clock = request_scheduler::clock;
+
+static std::uint64_t ms(std::uint64_t t) { return t * 1000 * 1000; }
+
+struct Trace_tester : public fructose::test_base<Trace_tester> {
+	std::string dir;
+	std::string path;
+
+	void setup() {
+		char tmp[] = "/tmp/mmbwmon_trace_test.XXXXXX";
+		dir = mkdtemp(tmp);
+		path = dir + "/trace";
+	}
+
+	void teardown() { std::system(("rm -rf " + dir).c_str()); }
+
+	void round_trip(const std::string &test_name) {
+		(void)test_name;
+		const request_scheduler::measurement m{0.5, 0.01, 0.005, 12.0};
+		{
+			trace_writer writer(path, trace_header{10, 100, {0, 0, 1, 1}});
+			writer.write(trace_record{trace_record::message, ms(3), "payload", {}, {}, 0.0});
+			writer.measurement({0, 1}, m);
+			writer.reply({0, 1}, m, 0.25);
+		}
+
+		trace_reader reader(path);
+		fructose_assert_eq(10, reader.header().window_ms);
+		fructose_assert_eq(100, reader.header().ttl_ms);
+		fructose_assert(reader.header().nodes == std::vector<std::uint32_t>({0, 0, 1, 1}));
+
+		trace_record r;
+		fructose_assert(reader.next(r));
+		fructose_assert(r.kind == trace_record::message);
+		fructose_assert_eq(ms(3), r.time_ns);
+		fructose_assert_eq("payload", r.payload);
+		fructose_assert(reader.next(r));
+		fructose_assert(r.kind == trace_record::measurement);
+		fructose_assert(r.cores == cores_t({0, 1}));
+		fructose_assert_eq(0.5, r.result.result);
+		fructose_assert_eq(12.0, r.result.consumed);
+		const std::uint64_t measured = r.time_ns;
+		fructose_assert(reader.next(r));
+		fructose_assert(r.kind == trace_record::reply);
+		fructose_assert_eq(0.25, r.age);
+		fructose_assert(r.time_ns >= measured);
+		fructose_assert(!reader.next(r));
+	}
+
+	// the requests of a synthesized trace replayed through a simulated scheduler, like the replay tool does
+	void replay(const std::string &test_name) {
+		(void)test_name;
+		// arrival in ms and cores, CPUs 0 and 1 are on node 0, 2 and 3 on node 1
+		const std::vector<std::pair<std::uint64_t, cores_t>> arrivals = {
+			{0, {0}}, {2, {2}}, {4, {1}}, {30, {0}}, {200, {0}}, {201, {0, 0}},
+		};
+		{
+			trace_writer writer(path, trace_header{10, 100, {0, 0, 1, 1}});
+			for (const auto &a : arrivals) {
+				const std::string payload = fast::msg::agent::mmbwmon::request(a.second).to_string();
+				writer.write(trace_record{trace_record::message, ms(a.first), payload, {}, {}, 0.0});
+			}
+		}
+
+		trace_reader reader(path);
+		const trace_header header = reader.header();
+		size_t measurements = 0;
+		const auto measure = [&](const cores_t &) {
+			++measurements;
+			return request_scheduler::measurement{0.5, 0.0, 0.005, -1.0};
+		};
+		const auto node_of = [&](size_t core) { return static_cast<size_t>(header.nodes.at(core)); };
+
+		request_scheduler *scheduler = nullptr;
+		std::set<double> rounds; // the reply times of the measurements in ms
+		std::vector<double> hits; // the ages of the cached results in ms
+		size_t replies = 0;
+		const auto reply = [&](const cores_t &, const request_scheduler::measurement &, double age) {
+			++replies;
+			if (age > 0.0)
+				hits.push_back(age * 1000.0);
+			else
+				rounds.insert(std::chrono::duration<double, std::milli>(scheduler->now().time_since_epoch()).count());
+		};
+
+		request_scheduler s(measure, node_of, reply, std::chrono::milliseconds(header.window_ms),
+							std::chrono::milliseconds(header.ttl_ms), request_scheduler::simulated_t{});
+		scheduler = &s;
+		trace_record r;
+		size_t requests = 0;
+		while (reader.next(r)) {
+			fast::msg::agent::mmbwmon::request req;
+			req.from_string(r.payload);
+			fructose_assert(req.cores == arrivals[requests].second);
+			++requests;
+			s.advance_to(sched_clock::time_point(
+				std::chrono::duration_cast<sched_clock::duration>(std::chrono::nanoseconds(r.time_ns))));
+			s.submit(req.cores);
+		}
+		s.advance_to(sched_clock::time_point::max());
+		fructose_assert_eq(arrivals.size(), requests);
+
+		// the first window closes at 10 ms: {0} and {2} are measured together until 15 ms, {1} shares
+		// node 0 and follows until 20 ms. {0} at 30 ms is served from the cache, at 200 ms it expired
+		// and the duplicate at 201 ms joins the batch measured from 210 to 215 ms.
+		fructose_assert_eq(4, measurements);
+		fructose_assert(rounds == std::set<double>({15.0, 20.0, 215.0}));
+		fructose_assert_eq(1, hits.size());
+		fructose_assert_double_eq(15.0, hits.at(0));
+		fructose_assert_eq(5, replies);
+	}
+};
+
+int main(int argc, char **argv) {
+	Trace_tester tests;
+	tests.add_test("round-trip", &Trace_tester::round_trip);
+	tests.add_test("replay", &Trace_tester::replay);
+	return tests.run(argc, argv);
+}